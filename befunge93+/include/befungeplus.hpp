@@ -1,27 +1,54 @@
 #ifndef INCLUDE_BEFUNGEPLUS_HPP
     #define INCLUDE_BEFUNGEPLUS_HPP
+#include "../../common/include/vmcore.hpp"
+#include "../../common/include/bufferio.hpp"
 #include <iostream>
 #include <stdlib.h>
 #include <fstream>
 #include <string>
 #include <stack>
 #include <vector>
+#include <unordered_map>
+#include <map>
+#include <algorithm>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
+#include <cassert>
 
 
 
 static const signed long long pointer_mask = 3UL << 63;
 static const signed long long not_pointer_mask = ~(3UL << 63);
 
-struct pair {
-    signed long long first,second;
+// a vector of n values is a run of 1 + (n + 1) / 2 cells: a
+// VECTOR_CELL with the length in head, then the values two per
+// cell in VECTOR_BODY cells. Pointers only point at run starts.
+//
+// A CDR_PAIR holds two elements of a list the collector compacted,
+// their heads in head and tail. A pointer to the first is the cell,
+// to the second the address of its tail field; the tail of the first
+// is the second and the tail of the second the next cell, see
+// Heap::tail_of()
+enum CellKind : unsigned char {
+    CONS_CELL = 0,
+    VECTOR_CELL,
+    VECTOR_BODY,
+    CDR_PAIR
 };
 
 struct Cell {
     signed long long head,tail;
     bool marked;
     bool free;
-    Cell(): marked(false){}
-    Cell(signed long long int head, signed long long int tail): head(head), tail(tail), marked(false) {}
+    CellKind kind;
+    bool queued;        // RefCountGC: waiting to be reclaimed
+    unsigned int count; // RefCountGC: references to the cell
+    Cell(): marked(false), kind(CONS_CELL) {}
+    Cell(signed long long int head, signed long long int tail): head(head), tail(tail), marked(false), kind(CONS_CELL) {}
 };
 
 inline Cell * pointer_to_addr(signed long long p) {
@@ -59,22 +86,46 @@ class FreeList {
 };
 
 class Heap {
+    PageArray memory;
     Cell* cells;
     int curr_index_allocation;
-    FreeList free_list;
+    FreeList free_list; // single free cells
+    std::multimap<int, int> free_runs; // longer runs of free cells, length to first index
     static const int capacity = 1 << 24;
+    int limit; // cells in use, at most capacity
 
     int curr_size;
 
+    // the first cells of a free run, the rest stays free
+    Cell* take_run(std::multimap<int, int>::iterator run, int length) {
+        Cell* taken = &cells[run->second];
+        int rest = run->first - length;
+        int rest_start = run->second + length;
+        free_runs.erase(run);
+        add_free_run(rest_start, rest);
+        return taken;
+    }
+
+    void add_free_run(int start, int length) {
+        if (length == 1) {
+            free_list.insertFront(&cells[start]);
+        } else if (length > 1) {
+            free_runs.insert(std::make_pair(length, start));
+        }
+    }
+
     public:
         static int max_capacity() {
             return capacity;
         }
 
-        Heap(): cells(new Cell[capacity]),  curr_index_allocation(-1), free_list(FreeList()), curr_size(0) {}
+        // the zeros of a new mapping are cells as Cell() leaves them,
+        // so none of the heap is touched before it is allocated
+        Heap(): memory(capacity * sizeof(Cell)), cells((Cell*)memory.data()), curr_index_allocation(-1),
+            free_list(FreeList()), limit(capacity), curr_size(0) {}
 
-        ~Heap() {
-            delete[] cells;
+        const PageArray& pages() {
+            return memory;
         }
 
         int size() {
@@ -82,27 +133,40 @@ class Heap {
         }
 
         bool hasSpace() {
-            return !free_list.empty() || curr_index_allocation < (capacity - 1);
+            return !free_list.empty() || !free_runs.empty() || curr_index_allocation < (limit - 1);
+        }
+
+        // room for a run of that many cells
+        bool hasSpace(int length) {
+            return curr_index_allocation + length <= limit - 1 || free_runs.lower_bound(length) != free_runs.end();
+        }
+
+        static long long vector_cells(long long length) {
+            return 1 + (length + 1) / 2;
+        }
+
+        // the i-th value of the vector starting at header
+        static signed long long& element(Cell* header, long long i) {
+            Cell& cell = header[1 + i / 2];
+            return i % 2 == 0 ? cell.head : cell.tail;
         }
 
         signed long long int allocate(signed long long int head, signed long long int tail) {
             // full heap
             // start using freelist
-            if (curr_index_allocation == (capacity - 1) ) {
-                if (!free_list.empty()) {
-                    Cell* free_cell = free_list.removeFront();
+            if (curr_index_allocation == (limit - 1) ) {
+                if (!free_list.empty() || !free_runs.empty()) {
+                    Cell* free_cell = !free_list.empty() ? free_list.removeFront() : take_run(free_runs.begin(), 1);
                     free_cell->head = head;
                     free_cell->tail = tail;
                     free_cell->free = false;
                     free_cell->marked = false;
+                    free_cell->kind = CONS_CELL;
                     ++curr_size;
                     return (signed long long int)(free_cell) | pointer_mask;
                 } else{
-                    // OOM
-                    std::cerr << "Out of memory" << std::endl;
-                    print_contents();
-                    exit(-1);
-
+                    // full, the GC checks hasSpace() first and
+                    // reports the program out of memory
                     return (signed long long)NULL;
                 }
             } else { // non empty just insert
@@ -110,32 +174,104 @@ class Heap {
                 cells[curr_index_allocation].head = head;
                 cells[curr_index_allocation].tail = tail;
                 cells[curr_index_allocation].free = false;
+                cells[curr_index_allocation].kind = CONS_CELL;
                 ++curr_size;
                 return (signed long long int)(&cells[curr_index_allocation])| pointer_mask;
             }
         }
 
-        // free cell
+        // a vector of zeros in one run of cells, NULL without
+        // a long enough run
+        signed long long int allocate_vector(long long length) {
+            int run = vector_cells(length);
+            Cell* header;
+            if (curr_index_allocation + run <= limit - 1) {
+                header = &cells[curr_index_allocation + 1];
+                curr_index_allocation += run;
+            } else {
+                std::multimap<int, int>::iterator free_run = free_runs.lower_bound(run);
+                if (free_run == free_runs.end()) {
+                    return (signed long long)NULL;
+                }
+                header = take_run(free_run, run);
+            }
+
+            for (int i = 0; i < run; i++) {
+                header[i].head = header[i].tail = 0;
+                header[i].free = false;
+                header[i].marked = false;
+                header[i].kind = VECTOR_BODY;
+            }
+            header->kind = VECTOR_CELL;
+            header->head = length;
+            curr_size += run;
+            return (signed long long int)header | pointer_mask;
+        }
+
+        // a cons cell, taken from the free list before the bump
+        // allocator, for collectors that free cells one at a time
+        signed long long int allocate_reusing(signed long long int head, signed long long int tail) {
+            if (free_list.empty()) {
+                return allocate(head, tail);
+            }
+            Cell* free_cell = free_list.removeFront();
+            free_cell->head = head;
+            free_cell->tail = tail;
+            free_cell->free = false;
+            free_cell->marked = false;
+            free_cell->kind = CONS_CELL;
+            ++curr_size;
+            return (signed long long int)(free_cell) | pointer_mask;
+        }
+
+        // free a cons cell or a whole vector right away, without
+        // merging it with free neighbours as a sweep does
+        void release(Cell* cell) {
+            int length = cell->kind == VECTOR_CELL ? vector_cells(cell->head) : 1;
+            int start = index_of(cell);
+            for (int i = start; i < start + length; i++) {
+                free_cell(&cells[i]);
+            }
+            add_free_run(start, length);
+        }
+
+        // free cell, free_unmarked() files it under the free space
         void free_cell(Cell* cell){
             --curr_size;
             cell->head = 0xDEADBABE;    // tracker for wrong frees
             cell->tail = 0;
             cell->marked = false;
             cell->free = true;
-            free_list.insertFront(cell);
         }
 
         static bool isPointer(signed long long candidate) {
             return (candidate & pointer_mask) != 0;
         }
 
+        // the free space is rebuilt on the way, neighbouring free
+        // cells merge into runs and a run at the end of the
+        // allocated cells goes back to the bump allocator
         void free_unmarked() {
+            free_list = FreeList();
+            free_runs.clear();
+
+            int run_start = -1;
             for (int i = 0; i <= curr_index_allocation; i++) {
                 if (!cells[i].free && !cells[i].marked) {
                     free_cell(&cells[i]);
                 } else {
                     cells[i].marked = false;
                 }
+
+                if (cells[i].free && run_start < 0) {
+                    run_start = i;
+                } else if (!cells[i].free && run_start >= 0) {
+                    add_free_run(run_start, i - run_start);
+                    run_start = -1;
+                }
+            }
+            if (run_start >= 0) {
+                curr_index_allocation = run_start - 1;
             }
         }
 
@@ -145,150 +281,897 @@ class Heap {
             }
         }
 
-};
+        // every cell free again, the next allocation takes the first
+        void reset() {
+            curr_index_allocation = -1;
+            free_list = FreeList();
+            free_runs.clear();
+            curr_size = 0;
+        }
+
+        // use only the first cells of the heap, on an empty heap
+        void set_limit(int cells) {
+            limit = std::min(std::max(cells, 1), capacity);
+        }
+
+        int cell_limit() {
+            return limit;
+        }
+
+        // number of cells handed out by the bump allocator so far
+        int allocated() {
+            return curr_index_allocation + 1;
+        }
+
+        Cell* cell_at(int i) {
+            return &cells[i];
+        }
+
+        int index_of(Cell* cell) {
+            return cell - cells;
+        }
+
+        // a pointer to a live cons cell, list element or vector of this heap
+        bool owns(signed long long candidate) {
+            if (!isPointer(candidate)) {
+                return false;
+            }
+            char* address = (char*)pointer_to_addr(candidate);
+            if (address < (char*)cells || address >= (char*)(cells + allocated())) {
+                return false;
+            }
+            size_t offset = (address - (char*)cells) % sizeof(Cell);
+            Cell* cell = (Cell*)(address - offset);
+            if (cell->free) {
+                return false;
+            }
+            return offset == 0 ? cell->kind != VECTOR_BODY : offset == sizeof(cell->head) && cell->kind == CDR_PAIR;
+        }
+
+        bool owns_cons(signed long long candidate) {
+            return owns(candidate) && cell_of(candidate)->kind != VECTOR_CELL;
+        }
+
+        bool owns_vector(signed long long candidate) {
+            return owns(candidate) && pointer_to_addr(candidate)->kind == VECTOR_CELL;
+        }
 
+        // the cell an owned pointer points into
+        Cell* cell_of(signed long long pointer) {
+            char* address = (char*)pointer_to_addr(pointer);
+            return (Cell*)(address - (address - (char*)cells) % sizeof(Cell));
+        }
 
-class GC;
+        // of an owned list element, the head is always the word it points at
+        static signed long long head_of(signed long long pointer) {
+            return *(signed long long*)pointer_to_addr(pointer);
+        }
 
-// BEFUNGE STACK
-class Stack {
+        signed long long tail_of(signed long long pointer) {
+            Cell* cell = cell_of(pointer);
+            if (cell->kind != CDR_PAIR) {
+                return cell->tail;
+            }
+            return pointer_to_addr(pointer) == cell ? (signed long long)&cell->tail | pointer_mask
+                                                    : (signed long long)(cell + 1) | pointer_mask;
+        }
+
+};
+
+
+// Allocation-site heap profiler. Every cell allocated by a
+// 'c' is tagged with the grid location of that 'c'. At each
+// collection (after marking) and at exit the live cells are
+// summed up per site and a report is appended to the output
+// stream. dump() writes every resident cell in a line based
+// format for offline analysis:
+//
+//   befunge93+ heap dump v1
+//   cell <index> <x> <y> <age> <marked> <head> <tail>
+//
+// where <age> is the number of collections the cell survived
+// and <tail> is given as a cell index when it is a pointer.
+class HeapProfiler {
     private:
-        friend class GC;
-        
-        int curr_index;
-        signed long long int* contents;
-        static const int capacity = 1 << 20;
+        static const int width = 80;
+        static const int height = 25;
+        static const int n_sites = width * height;
+        static const unsigned short no_site = 0xFFFF;
+
+        struct SiteStats {
+            long long allocated;
+            long long live;
+            long long survived; // live cells that outlived at least one collection
+            long long survivals; // total collections survived by cells of this site
+        };
+
+        std::ostream& out;
+        std::vector<unsigned short> site_of;
+        std::vector<unsigned char> age_of;
+        SiteStats sites[n_sites];
+        int collections;
+
+        void reset_live() {
+            for (int i = 0; i < n_sites; i++) {
+                sites[i].live = sites[i].survived = sites[i].survivals = 0;
+            }
+        }
+
+        void count_live(Heap& heap, bool only_marked) {
+            reset_live();
+            for (int i = 0; i < heap.allocated(); i++) {
+                Cell* cell = heap.cell_at(i);
+                if (cell->free || (only_marked && !cell->marked) || site_of[i] == no_site) {
+                    continue;
+                }
+
+                SiteStats& site = sites[site_of[i]];
+                ++site.live;
+                site.survivals += age_of[i];
+                if (age_of[i] > 0) {
+                    ++site.survived;
+                }
+            }
+        }
+
+        void report(const char* when) {
+            std::vector<int> order;
+            long long total_live = 0;
+            for (int i = 0; i < n_sites; i++) {
+                if (sites[i].allocated > 0) {
+                    order.push_back(i);
+                    total_live += sites[i].live;
+                }
+            }
+
+            std::sort(order.begin(), order.end(), [&](int a, int b) {
+                return sites[a].live > sites[b].live;
+            });
+
+            out << "== heap profile (" << when << ", collection " << collections << "): "
+                << total_live << " live cells, " << total_live * (long long)sizeof(Cell) << " bytes" << std::endl;
+            out << "x\ty\tlive\tbytes\tsurvived\tsurvivals\tallocated" << std::endl;
+            for (int i : order) {
+                out << i % width << "\t" << i / width << "\t" << sites[i].live << "\t"
+                    << sites[i].live * (long long)sizeof(Cell) << "\t" << sites[i].survived << "\t"
+                    << sites[i].survivals << "\t" << sites[i].allocated << std::endl;
+            }
+        }
+
     public:
-   
-        Stack(): curr_index(-1), contents(new signed long long int[capacity]) {}
-        ~Stack() {
-            delete [] contents;
+        HeapProfiler(std::ostream& out): out(out), site_of(Heap::max_capacity(), no_site),
+            age_of(Heap::max_capacity(), 0), sites(), collections(0) {}
+
+        // cells is the length of the run, more than one for a vector
+        void on_allocate(Heap& heap, signed long long cell, int x, int y, int cells = 1) {
+            int first = heap.index_of(pointer_to_addr(cell));
+            for (int i = first; i < first + cells; i++) {
+                site_of[i] = y * width + x;
+                age_of[i] = 0;
+            }
+            sites[y * width + x].allocated += cells;
         }
 
-        static int max_capacity() {
-            return capacity;
+        // called between mark and sweep
+        void on_collect(Heap& heap) {
+            ++collections;
+            for (int i = 0; i < heap.allocated(); i++) {
+                Cell* cell = heap.cell_at(i);
+                if (!cell->free && cell->marked && age_of[i] < 255) {
+                    ++age_of[i];
+                }
+            }
+            count_live(heap, true);
+            report("gc");
         }
 
-        int size() {
-            return curr_index + 1;
+        // called with the reachable cells marked
+        void on_exit(Heap& heap) {
+            count_live(heap, true);
+            report("exit");
         }
 
-        void push(signed long long int item) {
+        void dump(Heap& heap, std::ostream& dump_out) {
+            dump_out << "befunge93+ heap dump v1" << std::endl;
+            for (int i = 0; i < heap.allocated(); i++) {
+                Cell* cell = heap.cell_at(i);
+                if (cell->free) {
+                    continue;
+                }
 
-            if (curr_index == capacity) {
-                std::cerr << "Stack overflow" << std::endl;
-                exit(-1);
+                int x = site_of[i] == no_site ? -1 : site_of[i] % width;
+                int y = site_of[i] == no_site ? -1 : site_of[i] / width;
+                dump_out << "cell " << i << " " << x << " " << y << " " << (int)age_of[i] << " "
+                         << cell->marked << " " << cell->head << " ";
+                if (Heap::isPointer(cell->tail)) {
+                    dump_out << "@" << heap.index_of(pointer_to_addr(cell->tail));
+                } else {
+                    dump_out << cell->tail;
+                }
+                dump_out << std::endl;
             }
+        }
+};
 
-            
-            ++curr_index;
-            contents[curr_index] = item;
+
+// Work-stealing deque used by the parallel marker (Chase-Lev,
+// in the C11 formulation of Le et al.). The owning worker pushes
+// and pops at the bottom without locking, idle workers steal
+// from the top with a compare-and-swap on it. Only the owner
+// grows the ring; the rings it outgrew stay readable by thieves
+// until the mark is over.
+class MarkDeque {
+    private:
+        struct Ring {
+            long size; // a power of two
+            std::unique_ptr<std::atomic<Cell*>[]> slots;
+
+            Ring(long size): size(size), slots(new std::atomic<Cell*>[size]) {}
+
+            Cell* get(long i) {
+                return slots[i & (size - 1)].load(std::memory_order_relaxed);
+            }
+
+            void put(long i, Cell* cell) {
+                slots[i & (size - 1)].store(cell, std::memory_order_relaxed);
+            }
+        };
+
+        // apart so that thieves bumping top do not slow the owner down
+        alignas(64) std::atomic<long> top;
+        alignas(64) std::atomic<long> bottom;
+        std::atomic<Ring*> ring;
+        std::vector<std::unique_ptr<Ring>> rings; // the last one is current
+
+        static const long initial_size = 1 << 10;
+
+    public:
+        MarkDeque(): top(0), bottom(0) {
+            rings.emplace_back(new Ring(initial_size));
+            ring.store(rings.back().get(), std::memory_order_relaxed);
         }
 
-        signed long long int pop() {
-            // push 0, when empty
-            if (curr_index < 0) {
-                return 0;
+        // owner only
+        void push(Cell* cell) {
+            long b = bottom.load(std::memory_order_relaxed);
+            long t = top.load(std::memory_order_acquire);
+            Ring* r = ring.load(std::memory_order_relaxed);
+            if (b - t > r->size - 1) {
+                Ring* grown = new Ring(r->size * 2);
+                for (long i = t; i < b; i++) {
+                    grown->put(i, r->get(i));
+                }
+                rings.emplace_back(grown);
+                r = grown;
+                ring.store(r, std::memory_order_release);
             }
+            r->put(b, cell);
+            std::atomic_thread_fence(std::memory_order_release);
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
 
-            return contents[curr_index--];
+        // owner only, the most recently pushed cell
+        bool pop(Cell*& cell) {
+            long b = bottom.load(std::memory_order_relaxed) - 1;
+            Ring* r = ring.load(std::memory_order_relaxed);
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long t = top.load(std::memory_order_relaxed);
+            if (t > b) {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return false;
+            }
 
+            cell = r->get(b);
+            if (t == b) {
+                // the last one, thieves may be after it too
+                bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                       std::memory_order_relaxed);
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return won;
+            }
+            return true;
         }
 
-        bool empty() {
-            return curr_index == -1;
+        // any worker, the oldest cell
+        bool steal(Cell*& cell) {
+            long t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            long b = bottom.load(std::memory_order_acquire);
+            if (t >= b) {
+                return false;
+            }
+
+            Ring* r = ring.load(std::memory_order_acquire);
+            cell = r->get(t);
+            return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                               std::memory_order_relaxed);
         }
 
-        void dup() {
-            // if has more than self explanatory,
-            // else add a zero to the top
-            curr_index++;
-            if (curr_index > 0) {
-                contents[curr_index] = contents[curr_index - 1];
-            } else {
-                contents[curr_index] = 0;
+        // between marks, when no thief is left: drop the outgrown rings
+        void release_rings() {
+            if (rings.size() > 1) {
+                rings.erase(rings.begin(), rings.end() - 1);
             }
-            
         }
+};
 
-        void exchange_two_first() {
-            if (curr_index > 0) {
-                // has two elements, swap them
-                contents[curr_index] ^= contents[curr_index - 1];
-                contents[curr_index - 1] ^= contents[curr_index];
-                contents[curr_index] ^= contents[curr_index - 1];
-            } else if (curr_index == 0) {
-                // has one element, add a zero in front
-                curr_index++;
-                contents[curr_index] = 0;
-            } else {
-                // has no elements, add two zeros
-                curr_index += 2;
-                contents[0] = 0;
-                contents[1] = 0;
+// Parallel mark phase. The roots are split in equal slices
+// between a pool of workers (the calling thread is worker 0),
+// each worker seeds its own deque with its slice and steals
+// from the others once it runs dry. Mark bits are claimed
+// with an atomic test-and-set so every cell is traced once.
+// A long list is followed in place for split_chain cells at
+// a time, then its rest goes to the deque where an idle worker
+// can take it, so one list from one root does not leave the
+// whole mark to one worker.
+class ParallelMarker {
+    private:
+        int n_workers;
+        std::vector<std::thread> pool;
+        std::unique_ptr<MarkDeque[]> deques;
+
+        std::mutex pool_lock;
+        std::condition_variable start_cv;
+        std::condition_variable done_cv;
+        unsigned long epoch;
+        int running;
+        bool shutting_down;
+
+        Heap* heap; // tells cells from negative numbers
+        const signed long long* roots;
+        int n_roots;
+
+        // work items seeded or pushed but not yet traced
+        std::atomic<long> pending;
 
+        // cells of a chain traced before the rest is shared
+        static const int split_chain = 256;
+
+        static bool claim(Cell* cell) {
+            return !__atomic_test_and_set(&cell->marked, __ATOMIC_ACQ_REL);
+        }
+
+        // count the work before publishing it
+        void share(int id, signed long long value) {
+            if (heap->owns(value)) {
+                pending.fetch_add(1);
+                deques[id].push(heap->cell_of(value));
             }
         }
 
-        // helper
-        void print_stack() {
-            std::cout << "STACK BOTTOM" << std::endl;
-            for (int i = 0; i <= curr_index; i++) {
-                std::cout << contents[i] << std::endl;
+        void trace(int id, Cell* cell) {
+            // lists run through their tails, so follow the chain in
+            // place and hand heads and vector values to the deque
+            for (int followed = 0; claim(cell); followed++) {
+                if (cell->kind == VECTOR_CELL) {
+                    for (long long i = 0; i < cell->head; i++) {
+                        share(id, Heap::element(cell, i));
+                    }
+                    for (long long i = 1; i < Heap::vector_cells(cell->head); i++) {
+                        cell[i].marked = true;
+                    }
+                    return;
+                }
+                share(id, cell->head);
+                if (cell->kind == CDR_PAIR) {
+                    // the second element, its tail is the next cell
+                    share(id, cell->tail);
+                    if (followed >= split_chain) {
+                        pending.fetch_add(1);
+                        deques[id].push(cell + 1);
+                        return;
+                    }
+                    ++cell;
+                    continue;
+                }
+                if (!heap->owns(cell->tail)) {
+                    return;
+                }
+                if (followed >= split_chain) {
+                    share(id, cell->tail);
+                    return;
+                }
+                cell = heap->cell_of(cell->tail);
             }
-            std::cout << "STACK TOP" << std::endl;
         }
 
-        pair top_two() {
-            pair tt;
-            if (curr_index >= 1) {
-                tt.first = contents[curr_index];
-                tt.second = contents[curr_index-1];
-                
-            } else {
-                if (curr_index == -1) {
-                    tt.first = tt.second = -1;
+        bool find_work(int id, Cell*& cell) {
+            if (deques[id].pop(cell)) {
+                return true;
+            }
+
+            for (int i = 1; i < n_workers; i++) {
+                if (deques[(id + i) % n_workers].steal(cell)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void mark_slice(int id) {
+            int from = (long)n_roots * id / n_workers;
+            int to = (long)n_roots * (id + 1) / n_workers;
+
+            int seeded = 0;
+            for (int i = from; i < to; i++) {
+                if (heap->owns(roots[i])) {
+                    deques[id].push(heap->cell_of(roots[i]));
+                    ++seeded;
+                }
+            }
+            // publish the seeded work before dropping our seeding token
+            pending.fetch_add(seeded - 1);
+
+            Cell* cell;
+            while (pending.load() > 0) {
+                if (find_work(id, cell)) {
+                    trace(id, cell);
+                    pending.fetch_sub(1);
                 } else {
-                    tt.first = contents[curr_index];
-                    tt.second = -1;
+                    std::this_thread::yield();
                 }
             }
+        }
+
+        void worker_loop(int id) {
+            unsigned long seen = 0;
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> guard(pool_lock);
+                    start_cv.wait(guard, [&] { return shutting_down || epoch != seen; });
+                    if (shutting_down) {
+                        return;
+                    }
+                    seen = epoch;
+                }
 
-            return tt;
+                mark_slice(id);
+
+                std::lock_guard<std::mutex> guard(pool_lock);
+                if (--running == 0) {
+                    done_cv.notify_one();
+                }
+            }
         }
 
-};
+    public:
+        ParallelMarker(int n_workers): n_workers(n_workers), deques(new MarkDeque[n_workers]),
+            epoch(0), running(0), shutting_down(false), heap(NULL), roots(NULL), n_roots(0), pending(0) {
+            for (int i = 1; i < n_workers; i++) {
+                pool.emplace_back(&ParallelMarker::worker_loop, this, i);
+            }
+        }
 
+        ~ParallelMarker() {
+            {
+                std::lock_guard<std::mutex> guard(pool_lock);
+                shutting_down = true;
+            }
+            start_cv.notify_all();
+            for (std::thread& t : pool) {
+                t.join();
+            }
+        }
 
+        int workers() {
+            return n_workers;
+        }
 
-// Mark n' Sweep Garbage Collector
-class GC {
-    Stack& stack;
-    Heap& heap;
-    Stack pointers; // tracks pointers only
+        // mark everything of the heap reachable from roots[0..n)
+        void mark(Heap& root_heap, const signed long long* root_set, int n) {
+            {
+                std::lock_guard<std::mutex> guard(pool_lock);
+                heap = &root_heap;
+                roots = root_set;
+                n_roots = n;
+                pending.store(n_workers);
+                running = n_workers - 1;
+                ++epoch;
+            }
+            start_cv.notify_all();
+
+            mark_slice(0);
 
+            std::unique_lock<std::mutex> guard(pool_lock);
+            done_cv.wait(guard, [&] { return running == 0; });
+            for (int i = 0; i < n_workers; i++) {
+                deques[i].release_rings();
+            }
+        }
+};
+
+
+// Hash-consing table for cons cells. Cells are never mutated
+// after allocation, so a (head, tail) pair that is already
+// live can be shared instead of allocated again. The table is
+// split in independently locked shards so it can be probed
+// concurrently. Entries are weak: the GC drops the ones whose
+// cell was not marked before sweeping.
+class HashConsTable {
     private:
+        struct Key {
+            signed long long head, tail;
 
-        void mark(Cell* cell) {
-            if (cell->marked) {
-                return;
+            bool operator==(const Key& other) const {
+                return head == other.head && tail == other.tail;
+            }
+        };
+
+        struct KeyHash {
+            size_t operator()(const Key& key) const {
+                unsigned long long h = (unsigned long long)key.head * 0x9E3779B97F4A7C15ULL;
+                h ^= (unsigned long long)key.tail + 0x7F4A7C159E3779B9ULL + (h << 6) + (h >> 2);
+                return (size_t)(h ^ (h >> 29));
+            }
+        };
+
+        struct Shard {
+            std::mutex lock;
+            std::unordered_map<Key, signed long long, KeyHash> cells;
+        };
+
+        static const int n_shards = 64;
+        Shard shards[n_shards];
+
+        Shard& shard_for(const Key& key) {
+            return shards[KeyHash()(key) % n_shards];
+        }
+
+    public:
+        // tagged pointer of the live cell holding (head, tail), 0 if none
+        signed long long find(signed long long head, signed long long tail) {
+            Key key = {head, tail};
+            Shard& shard = shard_for(key);
+            std::lock_guard<std::mutex> guard(shard.lock);
+
+            auto it = shard.cells.find(key);
+            return it == shard.cells.end() ? 0 : it->second;
+        }
+
+        void insert(signed long long head, signed long long tail, signed long long cell) {
+            Key key = {head, tail};
+            Shard& shard = shard_for(key);
+            std::lock_guard<std::mutex> guard(shard.lock);
+            shard.cells[key] = cell;
+        }
+
+        // drop the entry of a cell freed without a sweep
+        void erase(signed long long head, signed long long tail, signed long long cell) {
+            Key key = {head, tail};
+            Shard& shard = shard_for(key);
+            std::lock_guard<std::mutex> guard(shard.lock);
+
+            auto it = shard.cells.find(key);
+            if (it != shard.cells.end() && it->second == cell) {
+                shard.cells.erase(it);
             }
+        }
 
-            cell->marked = true;
+        // clear the entries of cells about to be swept
+        void purge_unmarked() {
+            for (int i = 0; i < n_shards; i++) {
+                std::lock_guard<std::mutex> guard(shards[i].lock);
+                auto& cells = shards[i].cells;
+                for (auto it = cells.begin(); it != cells.end();) {
+                    if (!pointer_to_addr(it->second)->marked) {
+                        it = cells.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+            }
+        }
 
-            
-            if (Heap::isPointer(cell->tail)) {
-                mark(pointer_to_addr(cell->tail));
+        void clear() {
+            for (int i = 0; i < n_shards; i++) {
+                std::lock_guard<std::mutex> guard(shards[i].lock);
+                shards[i].cells.clear();
+            }
+        }
+
+        size_t size() {
+            size_t total = 0;
+            for (int i = 0; i < n_shards; i++) {
+                std::lock_guard<std::mutex> guard(shards[i].lock);
+                total += shards[i].cells.size();
+            }
+            return total;
+        }
+};
+
+// what the collector did so far, for benchmarks
+struct GCStats {
+    long long allocations; // cons cells and vectors handed out
+    long long collections;
+    long long pause_ns;    // all collections together
+    long long max_pause_ns;
+    int peak_cells;        // most cells in use at once
+    long long packed_cells; // cells CDR coding gave back
+
+    GCStats(): allocations(0), collections(0), pause_ns(0), max_pause_ns(0), peak_cells(0), packed_cells(0) {}
+};
+
+// Mark n' Sweep Garbage Collector
+//
+// Plugs into BasicVM as its memory manager: every push
+// and pop of the befunge stack goes through here so that
+// pointers can be tracked as roots.
+class GC {
+    protected:
+    Stack<signed long long>& stack;
+    Heap heap;
+    Stack<signed long long> pointers; // tracks pointers only
+    std::unique_ptr<ParallelMarker> marker; // NULL when marking sequentially
+    std::unique_ptr<HashConsTable> hash_cons; // NULL unless hash-consing
+    HeapProfiler* profiler; // NULL unless profiling
+    std::ostream* dump_out; // heap dump target of the profiler
+    Tracer* tracer; // NULL unless tracing
+    GCStats statistics;
+    volatile sig_atomic_t collecting; // read by the sampling profiler
+    PerfCounters* mark_counters; // NULL unless counting the phases
+    PerfCounters* sweep_counters;
+    std::vector<Cell*> gray; // cells mark() has yet to trace
+    bool cdr_coding; // pack lists two elements a cell when collecting under pressure
+    bool listing; // mark() keeps the index of every list cell it marks in lists
+    std::vector<int> lists;
+    signed long long in_flight[2]; // head and tail of the cell allocate() is collecting for
+    std::vector<unsigned char> tail_refs; // compact_lists() scratch
+    int live_after_collection; // cells the last collection left in use
+
+    // with fewer cells in use, so no more to mark, the pool
+    // costs more than it saves
+    static const int parallel_mark_threshold = 1 << 16;
+    // shorter lists are left as they are
+    static const int min_packed_list = 8;
+    // tail_refs of a cell after a pair and of one being packed
+    static const unsigned char pinned = 3, moving = 4;
+
+    protected:
+
+        // with a stack of its own, chains a million cells deep
+        // in either field would overflow the C++ one
+        void mark(Cell* root) {
+            gray.push_back(root);
+            while (!gray.empty()) {
+                Cell* cell = gray.back();
+                gray.pop_back();
+                if (cell->marked) {
+                    continue;
+                }
+
+                cell->marked = true;
+
+                if (cell->kind == VECTOR_CELL) {
+                    for (long long i = 1; i < Heap::vector_cells(cell->head); i++) {
+                        cell[i].marked = true;
+                    }
+                    for (long long i = 0; i < cell->head; i++) {
+                        signed long long value = Heap::element(cell, i);
+                        if (heap.owns(value)) {
+                            gray.push_back(heap.cell_of(value));
+                        }
+                    }
+                    continue;
+                }
+
+                if (listing) {
+                    lists.push_back(heap.index_of(cell));
+                }
+                if (cell->kind == CDR_PAIR) {
+                    // the tail of the second element
+                    gray.push_back(cell + 1);
+                }
+                if (heap.owns(cell->tail)) {
+                    gray.push_back(heap.cell_of(cell->tail));
+                }
+                if (heap.owns(cell->head)) {
+                    gray.push_back(heap.cell_of(cell->head));
+                }
             }
-        
         }
         // mark all cells
         void mark_garbage() {
-            signed long long* stack_contents = pointers.contents;
+            if (marker && heap.size() >= parallel_mark_threshold) {
+                // the tracked pointers are the root set,
+                // split between the marking workers
+                marker->mark(heap, pointers.data(), pointers.size());
+                for (int i = 0; listing && i < heap.allocated(); i++) {
+                    Cell* cell = heap.cell_at(i);
+                    if (cell->marked && !cell->free && (cell->kind == CONS_CELL || cell->kind == CDR_PAIR)) {
+                        lists.push_back(i);
+                    }
+                }
+            } else {
+                signed long long* stack_contents = pointers.data();
+
+                for (int i = 0; i < pointers.size(); i++) {
+                    if (heap.owns(stack_contents[i])) {
+                        mark(heap.cell_of(stack_contents[i]));
+                    }
+                }
+            }
+
+            for (signed long long value : in_flight) {
+                if (heap.owns(value)) {
+                    mark(heap.cell_of(value));
+                }
+            }
+        }
+
+        // the new place of a cell compact_lists() moves, kept in its tail
+        void relocate(signed long long& value) {
+            if (heap.owns(value) && heap.cell_of(value) == pointer_to_addr(value)) {
+                size_t index = heap.index_of(pointer_to_addr(value));
+                if (index < tail_refs.size() && tail_refs[index] == moving) {
+                    value = pointer_to_addr(value)->tail;
+                }
+            }
+        }
+
+        // whether the cell can take packed elements: garbage, or a
+        // cell of a list being packed, whose heads are saved by then
+        bool reusable(int i) {
+            Cell* cell = heap.cell_at(i);
+            return (!cell->marked && !cell->free) || tail_refs[i] == moving;
+        }
+
+        // CDR coding. A chain of cons cells that is only entered at
+        // its first cell (every other one is the tail of just the one
+        // before it) is packed two elements a CDR_PAIR cell, the last
+        // one or two elements staying cons cells so that the final
+        // tail keeps a field. The packed cells go to runs of garbage
+        // and of cells of the chains being packed, from the start of
+        // the heap on; a chain only gets split when a run ends before
+        // it does, the last cell of the part then leading to the
+        // next. Every element frees a cell, so the chains always fit.
+        // Every pointer to a moved cell, on the stack or in the heap,
+        // is then set to its element. Runs between mark and sweep,
+        // the sweep frees the cells left over
+        void compact_lists() {
+            int allocated = heap.allocated();
+            // times a cons cell is the tail of another, 2 for more,
+            // pinned for a cell whose only tail is the pair before it
+            tail_refs.assign(allocated, 0);
+            for (int i : lists) {
+                Cell* cell = heap.cell_at(i);
+                if (cell->kind == CDR_PAIR && i + 1 < allocated) {
+                    tail_refs[i + 1] = pinned;
+                } else if (cell->kind == CONS_CELL && heap.owns(cell->tail) &&
+                           heap.cell_of(cell->tail)->kind == CONS_CELL) {
+                    unsigned char& refs = tail_refs[heap.index_of(pointer_to_addr(cell->tail))];
+                    if (refs < 2) {
+                        ++refs;
+                    }
+                }
+            }
+
+            struct Chain {
+                size_t first; // of its cells in moved and its heads
+                int length;
+                signed long long end; // the tail of the last element
+            };
+            std::vector<Chain> chains;
+            std::vector<int> moved;
+            std::vector<signed long long> heads;
+
+            for (int i : lists) {
+                Cell* cell = heap.cell_at(i);
+                if (cell->kind != CONS_CELL || tail_refs[i] == 1 || tail_refs[i] == pinned) {
+                    continue;
+                }
+
+                size_t first = moved.size();
+                while (true) {
+                    moved.push_back(heap.index_of(cell));
+                    heads.push_back(cell->head);
+                    if (!heap.owns(cell->tail) || heap.cell_of(cell->tail)->kind != CONS_CELL ||
+                        tail_refs[heap.index_of(pointer_to_addr(cell->tail))] != 1) {
+                        break;
+                    }
+                    cell = pointer_to_addr(cell->tail);
+                }
+
+                if (moved.size() - first < (size_t)min_packed_list) {
+                    moved.resize(first);
+                    heads.resize(first);
+                    continue;
+                }
+                chains.push_back({first, (int)(moved.size() - first), cell->tail});
+            }
+            if (chains.empty()) {
+                return;
+            }
+            for (int index : moved) {
+                tail_refs[index] = moving;
+            }
+
+            struct Part {
+                size_t first; // of its elements in heads
+                int length;
+                Cell* to;
+                signed long long next; // the first element of the next part, 0 for the last
+            };
+            std::vector<Part> parts;
+            int run = 0, run_left = 0;
+            for (const Chain& chain : chains) {
+                for (int placed = 0; placed < chain.length;) {
+                    while (run_left == 0) {
+                        while (!reusable(run)) {
+                            ++run;
+                        }
+                        while (run + run_left < allocated && reusable(run + run_left)) {
+                            ++run_left;
+                        }
+                    }
+                    int left = chain.length - placed;
+                    int cells = std::min(run_left, left - (left - 1) / 2);
+                    int length = cells == left - (left - 1) / 2 ? left : 2 * cells - 1;
+                    Cell* to = heap.cell_at(run);
+                    run += cells;
+                    run_left -= cells;
+
+                    if (placed > 0) {
+                        parts.back().next = (signed long long)to | pointer_mask;
+                    }
+                    int pairs = (length - 1) / 2;
+                    for (int j = 0; j < length; j++) {
+                        signed long long element = j < 2 * pairs ? (signed long long)(to + j / 2) + j % 2 * 8
+                                                                 : (signed long long)(to + pairs + j - 2 * pairs);
+                        heap.cell_at(moved[chain.first + placed + j])->tail = element | pointer_mask;
+                    }
+                    parts.push_back({chain.first + placed, length, to, 0});
+                    statistics.packed_cells += length - cells;
+                    placed += length;
+                }
+            }
 
+            // set every pointer while the cells are still where they were
+            signed long long* values = stack.data();
+            for (int i = 0; i < stack.size(); i++) {
+                relocate(values[i]);
+            }
+            values = pointers.data();
             for (int i = 0; i < pointers.size(); i++) {
-                if (Heap::isPointer(stack_contents[i])) {
-                    mark(pointer_to_addr(stack_contents[i]));
+                relocate(values[i]);
+            }
+            relocate(in_flight[0]);
+            relocate(in_flight[1]);
+            for (int i = 0; i < allocated; i++) {
+                Cell* cell = heap.cell_at(i);
+                if (cell->marked && !cell->free && cell->kind != VECTOR_CELL && tail_refs[i] != moving) {
+                    relocate(cell->head);
+                    relocate(cell->tail);
+                }
+            }
+            for (signed long long& head : heads) {
+                relocate(head);
+            }
+            for (Chain& chain : chains) {
+                relocate(chain.end);
+            }
+
+            for (int index : moved) {
+                heap.cell_at(index)->marked = false;
+            }
+            size_t chain = 0;
+            for (const Part& part : parts) {
+                const signed long long* head = &heads[part.first];
+                int pairs = (part.length - 1) / 2;
+                signed long long end = part.next == 0 ? chains[chain++].end : part.next;
+                for (int j = 0; j < part.length - pairs; j++) {
+                    Cell* cell = part.to + j;
+                    if (j < pairs) {
+                        cell->head = head[2 * j];
+                        cell->tail = head[2 * j + 1];
+                        cell->kind = CDR_PAIR;
+                    } else {
+                        int element = pairs + j;
+                        cell->head = head[element];
+                        cell->tail = element == part.length - 1 ? end : (signed long long)(cell + 1) | pointer_mask;
+                        cell->kind = CONS_CELL;
+                    }
+                    cell->marked = true;
                 }
             }
         }
@@ -297,13 +1180,132 @@ class GC {
             heap.free_unmarked();
         }
 
-        void collect_garbage() {
+        // packing moves cells and takes a pass of its own, so it
+        // waits for collections that free little: the last one left
+        // three quarters of the heap in use
+        bool packing() {
+            return cdr_coding && !profiler && !hash_cons &&
+                   live_after_collection >= heap.cell_limit() / 4 * 3;
+        }
+
+        // true when it packed the lists
+        bool collect_garbage() {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            statistics.peak_cells = std::max(statistics.peak_cells, heap.size());
+            ++statistics.collections;
+            collecting = 1;
+            if (tracer) {
+                tracer->event(TRACE_GC_START, 0, 0, heap.size());
+            }
+            if (mark_counters) {
+                mark_counters->start();
+            }
+            // the profiler counts cells by address and the table
+            // finds them by their fields, neither follows a move
+            bool packed = listing = packing();
             mark_garbage();
+            if (mark_counters) {
+                mark_counters->stop();
+            }
+            if (profiler) {
+                profiler->on_collect(heap);
+            }
+            if (hash_cons) {
+                hash_cons->purge_unmarked();
+            }
+            if (listing) {
+                compact_lists();
+                listing = false;
+                lists.clear();
+            }
+            if (sweep_counters) {
+                sweep_counters->start();
+            }
             sweep();
+            live_after_collection = heap.size();
+            if (sweep_counters) {
+                sweep_counters->stop();
+            }
+            collecting = 0;
+            if (tracer) {
+                tracer->event(TRACE_GC_END, 0, 0, heap.size());
+            }
+            record_pause(start);
+            return packed;
+        }
+
+        void record_pause(std::chrono::steady_clock::time_point start) {
+            long long pause = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+            statistics.pause_ns += pause;
+            statistics.max_pause_ns = std::max(statistics.max_pause_ns, pause);
         }
     public:
- 
-        GC(Stack& stack, Heap& heap): stack(stack), heap(heap) {}
+        static const bool has_heap = true;
+
+        GC(Stack<signed long long>& stack): stack(stack), pointers(stack.max_capacity()),
+            profiler(NULL), dump_out(NULL), tracer(NULL), collecting(0),
+            mark_counters(NULL), sweep_counters(NULL), cdr_coding(true), listing(false), in_flight{0, 0},
+            live_after_collection(0) {}
+
+        static bool is_pointer(signed long long candidate) {
+            return Heap::isPointer(candidate);
+        }
+
+        void set_profiler(HeapProfiler* heap_profiler, std::ostream* heap_dump) {
+            profiler = heap_profiler;
+            dump_out = heap_dump;
+        }
+
+        void set_tracer(Tracer* t) {
+            tracer = t;
+        }
+
+        // final profile: mark what is still reachable, report
+        // and dump it, then leave the mark bits cleared
+        void finish_profile() {
+            if (!profiler) {
+                return;
+            }
+
+            mark_garbage();
+            profiler->on_exit(heap);
+            if (dump_out) {
+                profiler->dump(heap, *dump_out);
+            }
+            for (int i = 0; i < heap.allocated(); i++) {
+                heap.cell_at(i)->marked = false;
+            }
+        }
+
+        // use n threads for the mark phase, 1 restores the sequential
+        // marker. No more than the cores: a marker without one of its
+        // own only waits for the others, so one core marks sequentially
+        void set_mark_threads(int n) {
+            unsigned int cores = std::thread::hardware_concurrency();
+            if (cores > 0) {
+                n = std::min(n, (int)cores);
+            }
+            if (n > 1) {
+                marker.reset(new ParallelMarker(n));
+            } else {
+                marker.reset();
+            }
+        }
+
+        // pack long lists when collecting under heap pressure, on by default
+        void set_cdr_coding(bool enabled) {
+            cdr_coding = enabled;
+        }
+
+        // share cells with equal (head, tail) instead of allocating again
+        void set_hash_consing(bool enabled) {
+            if (enabled) {
+                hash_cons.reset(new HashConsTable());
+            } else {
+                hash_cons.reset();
+            }
+        }
 
         signed long long pop() {
             signed long long val = stack.pop();
@@ -315,603 +1317,655 @@ class GC {
             return val;
         }
 
-        void push(signed long long val) {
+        signed long long pop_unchecked() {
+            signed long long val = stack.pop_unchecked();
+
             if (Heap::isPointer(val)) {
-                pointers.push(val);
+                pointers.pop();
             }
 
-            stack.push(val);
+            return val;
         }
 
-        
+        bool push(signed long long val) {
+            if (!stack.push(val)) {
+                return false;
+            }
 
-        signed long long allocate(signed long long head, signed long long tail) {
-            if (!heap.hasSpace()) {
-                
-                // don't forget to mark pointers we're inserting
-                if (Heap::isPointer(tail)) {
-                    mark(pointer_to_addr(tail));
+            if (Heap::isPointer(val)) {
+                pointers.push(val);
+            }
+            return true;
+        }
+
+        // string characters are bytes, a pointer only when negative
+        bool push_chars(const signed long long* chars, int n) {
+            int before = stack.size();
+            bool pushed = stack.push_span(chars, n);
+
+            for (int i = 0; i < stack.size() - before; i++) {
+                if (Heap::isPointer(chars[i])) {
+                    pointers.push(chars[i]);
                 }
+            }
+            return pushed;
+        }
+
+        bool dup() {
+            if (!stack.dup()) {
+                return false;
+            }
+
+            if (Heap::isPointer(stack.peek())) {
+                pointers.push(stack.peek());
+            }
+            return true;
+        }
+
+        void swap() {
+            // keep the pointers in the same order as on the stack
+            if (Heap::isPointer(stack.peek(0)) && Heap::isPointer(stack.peek(1))) {
+                pointers.exchange_two_first();
+            }
+
+            stack.exchange_two_first();
+        }
+
+        void on_exit() {
+            finish_profile();
+        }
+
+        // a new program starts, its old cells are garbage
+        // a new program starts on an empty heap, so the same
+        // program allocates the same addresses on every load
+        void clear() {
+            stack.clear();
+            pointers.clear();
+            heap.reset();
+            live_after_collection = 0;
+            if (hash_cons) {
+                hash_cons->clear();
+            }
+        }
 
-                if (Heap::isPointer(head)) {
-                    mark(pointer_to_addr(tail));
+        int heap_cells() {
+            return heap.size();
+        }
+
+        int collections() {
+            return statistics.collections;
+        }
+
+        const PageArray& heap_pages() {
+            return heap.pages();
+        }
+
+        // cells of the heap the bump allocator reached since the last clear
+        int heap_high_water() {
+            return heap.allocated();
+        }
+
+        // fault in the first cells of the heap up front
+        void prefault(int cells) {
+            heap.pages().prefault((size_t)cells * sizeof(Cell));
+        }
+
+        GCStats stats() {
+            GCStats current = statistics;
+            current.peak_cells = std::max(current.peak_cells, heap.size());
+            return current;
+        }
+
+        // a smaller heap, so that collections come sooner. The
+        // heap is emptied
+        void set_heap_cells(int cells) {
+            clear();
+            heap.set_limit(cells);
+        }
+
+        const volatile sig_atomic_t* gc_flag() {
+            return &collecting;
+        }
+
+        // count hardware events in every mark and every sweep,
+        // marker threads of a parallel mark are not included
+        void set_phase_counters(PerfCounters* mark, PerfCounters* sweep) {
+            mark_counters = mark;
+            sweep_counters = sweep;
+        }
+
+        // x, y is the grid location of the allocating instruction,
+        // 0 when the heap is full even after a collection
+        signed long long allocate(signed long long head, signed long long tail, int x = -1, int y = -1) {
+            if (hash_cons) {
+                signed long long shared = hash_cons->find(head, tail);
+                if (shared != 0) {
+                    return shared;
                 }
+            }
 
+            if (!heap.hasSpace()) {
+                // don't forget the pointers we're inserting, the
+                // collection may move what they point to
+                in_flight[0] = head;
+                in_flight[1] = tail;
+                // still full, packing the lists may free some
+                if (!collect_garbage() && !heap.hasSpace() && packing()) {
+                    collect_garbage();
+                }
+                head = in_flight[0];
+                tail = in_flight[1];
+                in_flight[0] = in_flight[1] = 0;
+
+                if (!heap.hasSpace()) {
+                    // out of memory, leave the evidence behind
+                    if (profiler) {
+                        finish_profile();
+                    }
+                    return 0;
+                }
+            }
 
-                collect_garbage();
+            signed long long cell = heap.allocate(head,tail);
+            ++statistics.allocations;
+            if (hash_cons) {
+                hash_cons->insert(head, tail, cell);
+            }
+            if (profiler && x >= 0) {
+                profiler->on_allocate(heap, cell, x, y);
             }
-            return heap.allocate(head,tail);
+            if (tracer) {
+                tracer->event(TRACE_ALLOCATE, x, y, cell, 1);
+            }
+            return cell;
         }
 
+        // of a cons cell, callers check is_cons() first
         signed long long get_head(signed long long addr) {
-            if (!Heap::isPointer(addr)) {
-                std::cerr << "Invalid pointer access" << std::endl;
-                exit(-1);
-            }
-            return pointer_to_addr(addr)->head;
+            assert(Heap::isPointer(addr));
+            return Heap::head_of(addr);
         }
 
         signed long long get_tail(signed long long addr) {
-            if (!Heap::isPointer(addr)) {
-                std::cerr << "Invalid pointer access" << std::endl;
-                exit(-1);
+            assert(Heap::isPointer(addr));
+            return heap.tail_of(addr);
+        }
+
+        bool is_cons(signed long long addr) {
+            return heap.owns_cons(addr);
+        }
+
+        // a vector of length zeros, 0 when the heap has no run that
+        // long even after a collection
+        signed long long allocate_vector(long long length, int x = -1, int y = -1) {
+            if (length > 2LL * Heap::max_capacity()) {
+                return 0;
+            }
+            int cells = Heap::vector_cells(length);
+
+            if (!heap.hasSpace(cells)) {
+                if (!collect_garbage() && !heap.hasSpace(cells) && packing()) {
+                    collect_garbage();
+                }
+                if (!heap.hasSpace(cells)) {
+                    if (profiler) {
+                        finish_profile();
+                    }
+                    return 0;
+                }
             }
 
-            return pointer_to_addr(addr)->tail;
+            signed long long vector = heap.allocate_vector(length);
+            ++statistics.allocations;
+            if (profiler && x >= 0) {
+                profiler->on_allocate(heap, vector, x, y, cells);
+            }
+            if (tracer) {
+                tracer->event(TRACE_ALLOCATE, x, y, vector, cells);
+            }
+            return vector;
         }
-};
 
-enum DIRECTION {
-        UP = 0,
-        DOWN,
-        LEFT,
-        RIGHT
-};
+        bool is_vector(signed long long addr) {
+            return heap.owns_vector(addr);
+        }
 
-struct PC {
-    
-    int x,y;
-
-    static const int maxlimitx = 79;
-    static const int maxlimity = 24;
-
-    int limitx = maxlimitx;
-    int limity = maxlimity;
-
-
-    void move(DIRECTION d) {
-        switch (d)
-        {
-        case UP:
-            y = y - 1  >= 0 ? y - 1: limity;
-            break;
-        case DOWN:
-            y = y + 1  <= limity ? y + 1: 0;
-            break;
-        case RIGHT:
-            x = x + 1  <= limitx ? x + 1: 0;
-            break;
-        case LEFT:
-            x = x - 1 >= 0 ? x - 1: limitx;
-        default:
-            break;
+        signed long long vector_length(signed long long vector) {
+            return pointer_to_addr(vector)->head;
         }
-    }
 
+        signed long long vector_element(signed long long vector, long long i) {
+            return Heap::element(pointer_to_addr(vector), i);
+        }
 
-    PC(): x(0), y(0) {}
+        void set_vector_element(signed long long vector, long long i, signed long long value) {
+            Heap::element(pointer_to_addr(vector), i) = value;
+        }
 };
 
+// Reference counting memory manager, for programs that need cells
+// back promptly and without pauses more than they need throughput.
+// Selected at compile time with -DREFCOUNT, see Collector.
+//
+// A cell counts its references from the befunge stack, from the
+// head and tail of cons cells and from vector elements. Pushes, dup
+// and stores count up at once. Pops and overwritten elements only
+// log the cell, and the log is applied in batches, so a value popped
+// and pushed again never sees its count reach zero. Cells whose
+// count reaches zero are queued, and every allocation reclaims a
+// few of them: their fields are counted down (which may queue more)
+// and their cells go back to the heap. Dropping a long list frees it
+// a few cells per allocation rather than in one cascade.
+//
+// Cons cells never change, but w can make a vector reach itself.
+// When the heap is full the queue is drained, and if that is not
+// enough a backup trace (the mark and sweep of GC) collects the
+// cycles, after which every count is rebuilt from the surviving
+// cells and the stack.
+class RefCountGC: public GC {
+    private:
+        // pops logged before the log is applied
+        static const size_t decrement_batch = 1 << 12;
+        // cells or vector elements reclaimed per allocation
+        static const int reclaim_batch = 16;
+
+        std::vector<Cell*> decrements; // references dropped, not yet counted down
+        std::vector<Cell*> dead;       // count reached zero
+        Cell* reclaiming;              // a vector being counted down, NULL if none
+        long long reclaim_next;        // its next element
+
+        Cell* owned(signed long long value) {
+            return Heap::isPointer(value) && heap.owns(value) ? pointer_to_addr(value) : NULL;
+        }
 
+        void count_up(signed long long value) {
+            if (Cell* cell = owned(value)) {
+                ++cell->count;
+            }
+        }
 
+        void log_down(signed long long value) {
+            if (Cell* cell = owned(value)) {
+                decrements.push_back(cell);
+            }
+        }
 
-// all valid commands
-static const char * charset = "0123456789+-*/%!`><^v?_|\":\\$.,#gp&~@cht ";
+        void count_down(Cell* cell) {
+            // 0 when the value was not a pointer yet as it was counted
+            if (cell->count == 0 || --cell->count > 0 || cell->queued) {
+                return;
+            }
+            cell->queued = true;
+            dead.push_back(cell);
+        }
 
-class VM {
-    private:
-        unsigned int program[25][80];
-        PC pc;
-        DIRECTION curr_dir;
-        Stack stack;
-        Heap heap;
+        void apply_decrements() {
+            for (Cell* cell : decrements) {
+                count_down(cell);
+            }
+            decrements.clear();
+        }
 
-        GC gc;
+        void release(Cell* cell) {
+            if (hash_cons && cell->kind == CONS_CELL) {
+                hash_cons->erase(cell->head, cell->tail, (signed long long)cell | pointer_mask);
+            }
+            heap.release(cell);
+        }
 
-        
+        // reclaim queued cells, at most budget cells and elements
+        void reclaim(long long budget) {
+            while (budget > 0) {
+                if (reclaiming) {
+                    long long length = reclaiming->head;
+                    for (; reclaim_next < length && budget > 0; --budget) {
+                        if (Cell* element = owned(Heap::element(reclaiming, reclaim_next++))) {
+                            count_down(element);
+                        }
+                    }
+                    if (reclaim_next < length) {
+                        return;
+                    }
+                    release(reclaiming);
+                    reclaiming = NULL;
+                    continue;
+                }
 
+                if (dead.empty()) {
+                    return;
+                }
+                Cell* cell = dead.back();
+                dead.pop_back();
+                cell->queued = false;
+                if (cell->count > 0) {
+                    // a number that equals its address was pushed again
+                    continue;
+                }
+                --budget;
 
+                if (cell->kind == VECTOR_CELL) {
+                    reclaiming = cell;
+                    reclaim_next = 0;
+                    continue;
+                }
+                if (Cell* head = owned(cell->head)) {
+                    count_down(head);
+                }
+                if (Cell* tail = owned(cell->tail)) {
+                    count_down(tail);
+                }
+                release(cell);
+            }
+        }
 
-        // transform bytecode to character
-        // everything not in valid commands has
-        // an offset of 255
-        static char bytecode_to_char(unsigned int a) {
-            if (a < 1000) {
-                 return charset[a];
-            } else {
-                return (char)(a - 1000);
+        // the share of work of one allocation
+        void step() {
+            if (decrements.size() >= decrement_batch) {
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                apply_decrements();
+                record_pause(start);
             }
+            reclaim(reclaim_batch);
         }
 
-    
-        // convert a char to bytecode to match with labels
-        // if char is not a valid command, add 255 to separate
-        // to completely separate it from command bytecode
-        // and allow 1-1 conversion
-        static unsigned int char_to_bytecode(const char a) {
-            switch (a)
-            {
-            case '0':
-                return 0;
-            case '1':
-                return 1;
-            case '2':
-                return 2;
-            case '3':
-                return 3;
-            case '4':
-                return 4;
-            case '5':
-                return 5;
-            case '6':
-                return 6;
-            case '7':
-                return 7;
-            case '8':
-                return 8;
-            case '9':
-                return 9;
-            case '+':
-                return 10;
-            case '-':
-                return 11;
-            case '*':
-                return 12;
-            case '/':
-                return 13;
-            case '%':
-                return 14;
-            case '!':
-                return 15;
-            case '`':
-                return 16;
-            case '>':
-                return 17;
-            case '<':
-                return 18;
-            case '^':
-                return 19;
-            case 'v':
-                return 20;
-            case '?':
-                return 21;
-            case '_':
-                return 22;
-            case '|':
-                return 23;
-            case '"':
-                return 24;
-            case ':':
-                return 25;
-            case '\\':
-                return 26;
-            case '$':
-                return 27;
-            case '.':
-                return 28;
-            case ',':
-                return 29;
-            case '#':
-                return 30;
-            case 'g':
-                return 31;
-            case 'p':
-                return 32;
-            case '&':
-                return 33;
-            case '~':
-                return 34;
-            case '@':
-                return 35;
-            case 'c':
-                return 36;
-            case 'h':
-                return 37;
-            case 't':
-                return 38;
-            case ' ':
-                return 39;
-            default:
-                return 1000 + a;
+        // everything that can be freed without a trace
+        void drain() {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            apply_decrements();
+            reclaim(LLONG_MAX);
+            record_pause(start);
+        }
+
+        // after a trace, the counts of the surviving cells from
+        // the cells themselves and the stack
+        void recount() {
+            for (int i = 0; i < heap.allocated(); i++) {
+                Cell* cell = heap.cell_at(i);
+                cell->count = 0;
+                cell->queued = false;
+            }
+            for (int i = 0; i < heap.allocated(); i++) {
+                Cell* cell = heap.cell_at(i);
+                if (cell->free) {
+                    continue;
+                }
+                if (cell->kind == CONS_CELL) {
+                    count_up(cell->head);
+                    count_up(cell->tail);
+                } else if (cell->kind == VECTOR_CELL) {
+                    for (long long e = 0; e < cell->head; e++) {
+                        count_up(Heap::element(cell, e));
+                    }
+                }
+            }
+            for (int i = 0; i < stack.size(); i++) {
+                count_up(stack.data()[i]);
             }
         }
 
+        // the backup trace, head and tail are on their way into a
+        // new cell and survive it. Skipped when draining the queue
+        // frees a cell, unless forced: a vector needs a whole run
+        void trace(signed long long head, signed long long tail, bool force) {
+            drain();
+            if (!force && heap.hasSpace()) {
+                return;
+            }
+            if (heap.owns(tail)) {
+                mark(pointer_to_addr(tail));
+            }
+            if (heap.owns(head)) {
+                mark(pointer_to_addr(head));
+            }
+            collect_garbage();
 
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            recount();
+            count_up(head);
+            count_up(tail);
+            record_pause(start);
+        }
 
     public:
-        VM(): pc(PC()), curr_dir(RIGHT), gc(GC(stack,heap)) {
-            srand(time(NULL));
+        // counts are kept per cell, so cells never move
+        RefCountGC(Stack<signed long long>& stack): GC(stack), reclaiming(NULL), reclaim_next(0) {
+            cdr_coding = false;
         }
 
-        void print_program() {
-            for (int i = 0; i <= pc.limity; i++) {
-                for (int j = 0; j <= pc.limitx; j++) {
-                   std::cout << bytecode_to_char(program[i][j]);
-                }
+        void set_cdr_coding(bool) {}
+
+        signed long long pop() {
+            signed long long val = GC::pop();
+            log_down(val);
+            return val;
+        }
+
+        signed long long pop_unchecked() {
+            signed long long val = GC::pop_unchecked();
+            log_down(val);
+            return val;
+        }
+
+        bool push(signed long long val) {
+            if (!GC::push(val)) {
+                return false;
             }
+            count_up(val);
+            return true;
         }
 
-        // read program from file, convert to bytecode
-        // and return program limits to avoid
-        void load_program(const char* input_file_path) {
-            std::ifstream program_file(input_file_path);
+        bool push_chars(const signed long long* chars, int n) {
+            int before = stack.size();
+            bool pushed = GC::push_chars(chars, n);
+            for (int i = 0; i < stack.size() - before; i++) {
+                count_up(chars[i]);
+            }
+            return pushed;
+        }
 
+        bool dup() {
+            if (!GC::dup()) {
+                return false;
+            }
+            count_up(stack.peek());
+            return true;
+        }
 
-            int limitx = pc.maxlimitx;
-            int limity = pc.maxlimity;
+        void clear() {
+            GC::clear();
+            decrements.clear();
+            dead.clear();
+            reclaiming = NULL;
+        }
 
-            if (program_file.is_open())
-            {
-                int i,j;
-                i = j = 0;
+        void set_heap_cells(int cells) {
+            clear();
+            heap.set_limit(cells);
+        }
 
-                char c;
+        signed long long allocate(signed long long head, signed long long tail, int x = -1, int y = -1) {
+            if (hash_cons) {
+                signed long long shared = hash_cons->find(head, tail);
+                if (shared != 0) {
+                    return shared;
+                }
+            }
 
-                // initialize program with null
-                // instructions
-                for (int i = 0; i <= pc.maxlimity; i++) {
-                    for (int j = 0; j <= pc.maxlimitx; j++) {
-                        program[i][j] = char_to_bytecode(' ');
+            // the new cell holds them from here on
+            count_up(head);
+            count_up(tail);
+            step();
+            if (!heap.hasSpace()) {
+                trace(head, tail, false);
+                if (!heap.hasSpace()) {
+                    log_down(head);
+                    log_down(tail);
+                    if (profiler) {
+                        finish_profile();
                     }
+                    return 0;
                 }
+            }
 
+            signed long long cell = heap.allocate_reusing(head, tail);
+            pointer_to_addr(cell)->count = 0;
+            pointer_to_addr(cell)->queued = false;
+            ++statistics.allocations;
+            statistics.peak_cells = std::max(statistics.peak_cells, heap.size());
+            if (hash_cons) {
+                hash_cons->insert(head, tail, cell);
+            }
+            if (profiler && x >= 0) {
+                profiler->on_allocate(heap, cell, x, y);
+            }
+            if (tracer) {
+                tracer->event(TRACE_ALLOCATE, x, y, cell, 1);
+            }
+            return cell;
+        }
 
-                // read program and convert to bytecode
-                while (program_file.get(c) && i >= 0 && j >= 0 && j <= limitx && i <= limity)
-                {
-                    if (c != '\n') {
-                        program[i][j] = char_to_bytecode(c);
-                    
-                        if (bytecode_to_char(char_to_bytecode(c)) != c) {
-                            std::cerr << "WRONG CONVERSION:" << c << std::endl;
-                        }
-                        ++j;
-                    } else { 
-                        ++i;
-                        j = 0;
+        signed long long allocate_vector(long long length, int x = -1, int y = -1) {
+            if (length > 2LL * Heap::max_capacity()) {
+                return 0;
+            }
+            int cells = Heap::vector_cells(length);
+
+            step();
+            if (!heap.hasSpace(cells)) {
+                drain();
+                if (!heap.hasSpace(cells)) {
+                    trace(0, 0, true);
+                }
+                if (!heap.hasSpace(cells)) {
+                    if (profiler) {
+                        finish_profile();
                     }
+                    return 0;
                 }
-                program_file.close();
+            }
 
-                if (!(i >= 0 && j >= 0 && j <= pc.maxlimitx && i <= pc.maxlimity)) {
-                    std::cerr << "i,j= " << i << "," << j << std::endl;
-                    std::cerr << "Not a valid befunge93 file" << std::endl;
-                    exit(-1);
-                }
+            signed long long vector = heap.allocate_vector(length);
+            pointer_to_addr(vector)->count = 0;
+            pointer_to_addr(vector)->queued = false;
+            ++statistics.allocations;
+            statistics.peak_cells = std::max(statistics.peak_cells, heap.size());
+            if (profiler && x >= 0) {
+                profiler->on_allocate(heap, vector, x, y, cells);
+            }
+            if (tracer) {
+                tracer->event(TRACE_ALLOCATE, x, y, vector, cells);
+            }
+            return vector;
+        }
 
-            } else {
-                std::cerr<< "Unable to open file" << std::endl; 
-                exit(-1);
-            } 
-
-        }
-
-        void execute(const char* input_file_path) {
-            #define NEXT_INS {\
-                jump_location = program[pc.y][pc.x];\
-                goto *(command_table[jump_location < n_commands? jump_location: n_commands]);}
-            
-            static const void* command_table[] = {
-                        &&NUM0_LAB,
-                        &&NUM1_LAB,
-                        &&NUM2_LAB,
-                        &&NUM3_LAB,
-                        &&NUM4_LAB,
-                        &&NUM5_LAB,
-                        &&NUM6_LAB,
-                        &&NUM7_LAB,
-                        &&NUM8_LAB,
-                        &&NUM9_LAB,
-                        &&ADD_LAB,
-                        &&SUB_LAB,
-                        &&MUL_LAB,
-                        &&DIV_LAB,
-                        &&MOD_LAB,
-                        &&NOT_LAB,
-                        &&GT_LAB,
-                        &&RIGHT_LAB,
-                        &&LEFT_LAB,
-                        &&UP_LAB,
-                        &&DOWN_LAB,
-                        &&RAND_LAB,
-                        &&HORIF_LAB,
-                        &&VERTIF_LAB,
-                        &&STRING_LAB,
-                        &&DUP_LAB,
-                        &&SWAP_LAB,
-                        &&POP_LAB,
-                        &&OUTI_LAB,
-                        &&OUTC_LAB,
-                        &&BRIDGE_LAB,
-                        &&GET_LAB,
-                        &&PUT_LAB,
-                        &&INPUTI_LAB,
-                        &&INPUTC_LAB,
-                        &&END_LAB,
-                        &&CONS_LAB,
-                        &&HEAD_LAB,
-                        &&TAIL_LAB,
-                        &&NULL_LAB,
-                        &&INVALID_LAB
-            };
+        void set_vector_element(signed long long vector, long long i, signed long long value) {
+            count_up(value);
+            log_down(vector_element(vector, i));
+            GC::set_vector_element(vector, i, value);
+        }
+};
 
-            static const int n_commands = 40;
-
-
-            load_program(input_file_path);
-            
-
-            signed long long value1,value2;
-            int jump_location;
-            char char_buf;
-
-            NEXT_INS;
-
-            ADD_LAB:
-                pc.move(curr_dir);
-                value2 = gc.pop();
-                value1 = gc.pop();
-                gc.push(value1 + value2);
-                NEXT_INS;
-            SUB_LAB:
-                pc.move(curr_dir);
-                value2 = gc.pop();
-                value1 = gc.pop();
-                gc.push(value1 - value2);
-                NEXT_INS;
-            MUL_LAB:
-                pc.move(curr_dir);
-                value2 = gc.pop();
-                value1 = gc.pop();
-                gc.push(value1 * value2);
-                NEXT_INS;
-            DIV_LAB:
-                pc.move(curr_dir);
-                value2 = gc.pop();
-                value1 = gc.pop();
-                if (value2 == 0) {
-                    std::cerr << "Error: Division by zero" << std::endl;
-                    exit(-1);
-                }
-                gc.push(value1 / value2);
-                NEXT_INS;
-            MOD_LAB:
-                pc.move(curr_dir);
-                value2 = gc.pop();
-                value1 = gc.pop();
-                if (value2 == 0) {
-                    std::cerr << "Error: Division by zero" << std::endl;
-                    exit(-1);
-                }
-                gc.push(value1 % value2);
-                NEXT_INS;
-            NOT_LAB:
-                pc.move(curr_dir);
-                value1 = gc.pop();
-                gc.push(value1 != 0? 0: 1);
-                NEXT_INS;
-            GT_LAB:
-                pc.move(curr_dir);
-                value2 = gc.pop();
-                value1 = gc.pop();
-                gc.push(value1 > value2? 1 : 0 );
-                NEXT_INS;
-            RIGHT_LAB:
-                curr_dir = RIGHT;
-                pc.move(curr_dir);
-                NEXT_INS;
-            LEFT_LAB:
-                curr_dir = LEFT;
-                pc.move(curr_dir);
-                NEXT_INS;
-            UP_LAB:
-                curr_dir = UP;
-                pc.move(curr_dir);
-                NEXT_INS;
-            DOWN_LAB:
-                curr_dir = DOWN;
-                pc.move(curr_dir);
-                NEXT_INS;
-            RAND_LAB:
-                int choice = rand() % 4;
-                curr_dir = (DIRECTION)choice;
-                pc.move(curr_dir);
-                NEXT_INS;
-            HORIF_LAB:
-                value1 = gc.pop();
-                curr_dir = value1 == 0 ? RIGHT: LEFT;
-                pc.move(curr_dir);
-                NEXT_INS;
-            VERTIF_LAB:
-                value1 = gc.pop();
-                curr_dir = value1 == 0 ? DOWN: UP;
-                pc.move(curr_dir);
-                NEXT_INS;
-            STRING_LAB:
-                // skip first "
-                pc.move(curr_dir);
-
-                // keep adding to stack until 
-                // " is met again
-                while(program[pc.y][pc.x] != 24) {
-                    // convert back to char
-                    gc.push(bytecode_to_char(program[pc.y][pc.x]));
-                    pc.move(curr_dir);
-                }
-                // skip second "                
-                pc.move(curr_dir);
-                NEXT_INS;
-            DUP_LAB:
-                pc.move(curr_dir);
-                stack.dup();
-                NEXT_INS;
-
-            SWAP_LAB:
-                pc.move(curr_dir);
-                stack.exchange_two_first();
-                NEXT_INS;
-            
-            POP_LAB:
-                pc.move(curr_dir);
-                gc.pop();
-                NEXT_INS;
-            
-            OUTI_LAB:
-                pc.move(curr_dir);
-                value1 = gc.pop();
-                std::cout << value1;
-                NEXT_INS;
-            
-            OUTC_LAB:
-                pc.move(curr_dir);
-                value1 = gc.pop();
-                std::cout << (char)value1;
-                NEXT_INS;
-            
-            BRIDGE_LAB:
-                pc.move(curr_dir);
-                pc.move(curr_dir);
-                NEXT_INS;
-            
-            GET_LAB:
-                pc.move(curr_dir);
-                value1 = gc.pop();
-                value2 = gc.pop();
-
-                if (value1 <= pc.limitx && value2 <= pc.limity && 
-                    value1 >= 0 && value2 >= 0) {
-                        gc.push(bytecode_to_char(program[value1][value2]));
-                } else {
-                    std::cerr << "GET: Invalid program location access: x=" << value1 << " y=" << value2 << std::endl;
-                    exit(-1);
-                }
+// the memory manager of befunge93+, mark and sweep unless built
+// with -DREFCOUNT
+#ifdef REFCOUNT
+typedef RefCountGC Collector;
+#else
+typedef GC Collector;
+#endif
 
-                NEXT_INS;
-            PUT_LAB:
-                pc.move(curr_dir);
-                value1 = gc.pop();
-                value2 = gc.pop();
+// befunge93+: 64 bit stack cells tagged as pointers
+// into a garbage collected heap of cons cells
+template <typename IO, typename Memory = Collector>
+class BefungePlus: public BasicVM<signed long long, Memory, IO> {
+    private:
+        static const int stack_size = 1 << 20;
+        std::unique_ptr<HeapProfiler> profiler;
 
-                if (value1 <= pc.limitx && value2 <= pc.limity && 
-                    value1 >= 0 && value2 >= 0) {
-                        signed long long new_value = gc.pop();
+    public:
+        BefungePlus(): BasicVM<signed long long, Memory, IO>(stack_size) {}
 
-                        if (new_value > 255) {
-                            std::cerr << "All program values have to be ascii chars, instead " 
-                            << new_value << "was given." << std::endl;
+        void set_mark_threads(int n) {
+            this->mem.set_mark_threads(n);
+        }
 
-                            exit(-1);
-                        }
-                        program[value1][value2] = char_to_bytecode(new_value);
-                } else {
-                    std::cerr << "PUT: Invalid program location access: x=" << value1 << " y=" << value2 << std::endl;
-                    exit(-1);
-                }
-                NEXT_INS;
-
-            INPUTI_LAB:
-                pc.move(curr_dir);
-                std::cin >> value1;
-                gc.push(value1);
-                NEXT_INS;
-            INPUTC_LAB:
-                pc.move(curr_dir);
-                std::cin.get(char_buf);
-                gc.push((signed long long int)char_buf);
-                NEXT_INS;
-            NUM0_LAB:
-                pc.move(curr_dir);
-                gc.push(0);
-                NEXT_INS;
-            NUM1_LAB:
-                pc.move(curr_dir);
-                gc.push(1);
-                NEXT_INS;
-            NUM2_LAB:
-                pc.move(curr_dir);
-                gc.push(2);
-                NEXT_INS;
-            NUM3_LAB:
-                pc.move(curr_dir);
-                gc.push(3);
-                NEXT_INS;
-            NUM4_LAB:
-                pc.move(curr_dir);
-                gc.push(4);
-                NEXT_INS;
-            NUM5_LAB:
-                pc.move(curr_dir);
-                gc.push(5);
-                NEXT_INS;
-            NUM6_LAB:
-                pc.move(curr_dir);
-                gc.push(6);
-                NEXT_INS;
-            NUM7_LAB:
-                pc.move(curr_dir);
-                gc.push(7);
-                NEXT_INS;
-            NUM8_LAB:
-                pc.move(curr_dir);
-                gc.push(8);
-                NEXT_INS;
-            NUM9_LAB:
-                pc.move(curr_dir);
-                gc.push(9);
-                NEXT_INS;
-            NULL_LAB:
-                pc.move(curr_dir);
-                NEXT_INS;
-            END_LAB:
-                return;
-            CONS_LAB:
-                pc.move(curr_dir);
-                value1 = gc.pop();
-                value2 = gc.pop();
-                signed long long val =  gc.allocate(value2,value1);
-                gc.push(val);
-                NEXT_INS;
-            HEAD_LAB:
-                pc.move(curr_dir);
-                value1 = gc.pop();
-
-                if (Heap::isPointer(value1)) {
-                    long long val = gc.get_head(value1);
-                    gc.push(val);
-                } else {
-                    std::cerr << "Invalid dereference " << value1 << std::endl;
-                    exit(-1);
-                }
-                NEXT_INS;
+        void set_hash_consing(bool enabled) {
+            this->mem.set_hash_consing(enabled);
+        }
 
-            TAIL_LAB:
-                pc.move(curr_dir);
-                value1 = gc.pop();
+        void set_cdr_coding(bool enabled) {
+            this->mem.set_cdr_coding(enabled);
+        }
 
-                if (Heap::isPointer(value1)) {
-                    gc.push(gc.get_tail(value1));
-                } else {
-                    std::cerr << "Invalid dereference " << value1 << std::endl;
-                    exit(-1);
-                }
+        // report live cells per allocation site to report_out,
+        // and dump the heap to dump_out (if given) at exit
+        void set_heap_profiler(std::ostream& report_out, std::ostream* dump_out) {
+            profiler.reset(new HeapProfiler(report_out));
+            this->mem.set_profiler(profiler.get(), dump_out);
+        }
+
+        // cells allocated and not yet swept
+        int heap_cells() {
+            return this->mem.heap_cells();
+        }
+
+        int collections() {
+            return this->mem.collections();
+        }
+
+        // the cons cell or vector a stack value points to, for tools
+        // that compare heaps by shape rather than by address
+        bool is_cell(signed long long value) {
+            return this->mem.is_cons(value);
+        }
+
+        bool is_vector(signed long long value) {
+            return this->mem.is_vector(value);
+        }
+
+        std::vector<signed long long> vector_of(signed long long vector) {
+            std::vector<signed long long> values;
+            for (long long i = 0; i < this->mem.vector_length(vector); i++) {
+                values.push_back(this->mem.vector_element(vector, i));
+            }
+            return values;
+        }
+
+        signed long long head_of(signed long long cell) {
+            return this->mem.get_head(cell);
+        }
 
-                NEXT_INS;
+        signed long long tail_of(signed long long cell) {
+            return this->mem.get_tail(cell);
+        }
+
+        void set_gc_perf_counters(PerfCounters* mark, PerfCounters* sweep) {
+            this->mem.set_phase_counters(mark, sweep);
+        }
 
-            INVALID_LAB:
-                std::cout << "Invalid command detected << " << bytecode_to_char(program[pc.y][pc.x]) 
-                            <<" >> at " << pc.y << "," << pc.x << ". Exiting."<< std::endl;
-                exit(-1);
+        // at most that many heap cells, capped at Heap::max_capacity()
+        void set_heap_cells(int cells) {
+            this->mem.set_heap_cells(cells);
+        }
+
+        GCStats gc_stats() {
+            return this->mem.stats();
+        }
+
+        const PageArray& heap_pages() {
+            return this->mem.heap_pages();
+        }
+
+        void report_pages(std::ostream& out) {
+            BasicVM<signed long long, Memory, IO>::report_pages(out);
+            out << "heap: " << heap_pages().describe() << std::endl;
         }
 };
 
+// the interpreter on stdin and stdout
+typedef BefungePlus<StdIO> VM;
+
+// the interpreter as a library, programs loaded with load_source()
+// and I/O through the caller's buffers, see BufferIO
+typedef BefungePlus<BufferIO> EmbeddedVM;
+
 #endif
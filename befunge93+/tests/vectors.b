@@ -0,0 +1,2 @@
+55+a:78c9c\3w"d":+:*>55+::**a$1-:v
+                    ^            _$:l.3r:h:h.t.t.@
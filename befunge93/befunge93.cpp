@@ -1,23 +1,245 @@
 #include "include/befunge.hpp"
+#include "../common/include/server.hpp"
+#include "../common/include/ensemble.hpp"
+#include "../common/include/stream.hpp"
 #include <iostream>
+#include <cstring>
+#include <fstream>
+#include <thread>
+#include <algorithm>
+#include <memory>
+#include <climits>
 
 int main(int argc, char *argv[]) {
-    if (argc < 2) {
+    char * file_path = NULL;
+    bool analyze = false;
+    const char * dot_path = NULL;
+    VMOptions options;
+    bool perf_counters = false;
+    const char * sample_path = NULL;
+    int sample_hz = 997;
+    bool sample_paused = false;
+    const char * socket_path = NULL;
+    int workers = std::thread::hardware_concurrency();
+    size_t cache_mb = 64;
+    long long ensemble_size = 0;
+    bool seeded = false;
+    unsigned long long seed = 0;
+    const char * summary = "concat";
+    const char * input_path = NULL;
+    long long max_instructions = LLONG_MAX;
+    bool stream = false;
+    char delimiter = '\n';
+    bool huge_pages = false;
+    const char * trace_path = NULL;
+    unsigned long long trace_records = 1 << 16;
+    const char * profile_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--analyze") == 0) {
+            analyze = true;
+        } else if (strcmp(argv[i], "--dot") == 0 && i + 1 < argc) {
+            // control flow graph of the analysis in graphviz format
+            analyze = true;
+            dot_path = argv[++i];
+        } else if (strcmp(argv[i], "--no-static-grid") == 0) {
+            options.fast_mode = false;
+        } else if (strcmp(argv[i], "--lift") == 0) {
+            options.lifting = true;
+        } else if (strcmp(argv[i], "--unbounded") == 0) {
+            // programs larger than 80x25 on a sparse grid, g and p anywhere
+            options.unbounded = true;
+        } else if (strcmp(argv[i], "--perf-counters") == 0) {
+            // hardware counters on stderr after the run
+            perf_counters = true;
+        } else if (strcmp(argv[i], "--sample-profile") == 0 && i + 1 < argc) {
+            // folded stacks for flamegraph.pl, written after the run
+            sample_path = argv[++i];
+        } else if (strcmp(argv[i], "--sample-hz") == 0 && i + 1 < argc) {
+            sample_hz = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--sample-paused") == 0) {
+            // start sampling on the first SIGUSR2
+            sample_paused = true;
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            // daemon on a Unix socket instead of running a file
+            socket_path = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc) {
+            // decoded programs the server keeps
+            cache_mb = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--ensemble") == 0 && i + 1 < argc) {
+            // that many runs, seeds seed..seed+N-1, on --workers threads
+            ensemble_size = std::max(1LL, atoll(argv[++i]));
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seeded = true;
+            seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--summary") == 0 && i + 1 < argc) {
+            summary = argv[++i];
+        } else if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            // input of every ensemble instance
+            input_path = argv[++i];
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            // every record of stdin through the program, on --workers threads
+            stream = true;
+        } else if (strcmp(argv[i], "--delimiter") == 0 && i + 1 < argc) {
+            // of the records and the outputs of --stream, a character or nul
+            ++i;
+            if (strcmp(argv[i], "nul") == 0) {
+                delimiter = '\0';
+            } else if (strlen(argv[i]) == 1) {
+                delimiter = argv[i][0];
+            } else {
+                std::cerr << "Delimiter " << argv[i] << " is not one character or nul" << std::endl;
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--max-instructions") == 0 && i + 1 < argc) {
+            max_instructions = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            // the last instructions before the end to FILE, see tracedump
+            trace_path = argv[++i];
+        } else if (strcmp(argv[i], "--trace-records") == 0 && i + 1 < argc) {
+            trace_records = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            // warm start from FILE when it profiles this program, saved at exit
+            profile_path = argv[++i];
+        } else if (strcmp(argv[i], "--huge-pages") == 0 && i + 1 < argc) {
+            // backing of the stack and heap arrays, reported after the run
+            huge_pages = true;
+            if (!PageArray::parse(argv[++i], PageArray::requested())) {
+                std::cerr << "Unknown page mode " << argv[i] << ", expected off, transparent or explicit" << std::endl;
+                exit(-1);
+            }
+        } else if (file_path == NULL) {
+            file_path = argv[i];
+        } else {
+            std::cerr << "Wrong number of arguments. One file required, " << argv[i] <<
+            " given as well. Exiting" << std::endl;
+            exit(-1);
+        }
+    }
+
+    if (options.unbounded && (analyze || sample_path != NULL)) {
+        std::cerr << "--analyze and --sample-profile need the 80x25 grid, not --unbounded" << std::endl;
+        exit(-1);
+    }
+
+    if (trace_path != NULL && (socket_path != NULL || ensemble_size > 0 || stream)) {
+        std::cerr << "--trace follows a single run, not --serve, --ensemble or --stream" << std::endl;
+        exit(-1);
+    }
+
+    if ((perf_counters || sample_path != NULL) && (socket_path != NULL || ensemble_size > 0 || stream)) {
+        std::cerr << "--perf-counters and --sample-profile report on a single run, not --serve, --ensemble or --stream" << std::endl;
+        exit(-1);
+    }
+
+    if (profile_path != NULL && (socket_path != NULL || ensemble_size > 0 || stream || options.unbounded ||
+                                 trace_path != NULL)) {
+        std::cerr << "--profile follows a single run on the 80x25 grid, not --serve, --ensemble, --stream, "
+                     "--unbounded or --trace" << std::endl;
+        exit(-1);
+    }
+
+    if (socket_path != NULL) {
+        Server<EmbeddedVM> server(socket_path, workers, cache_mb << 20);
+        server.configure(options);
+        return server.serve();
+    }
+
+    if (file_path == NULL) {
         std::cerr << "No file provided. Exiting." << std::endl;
         exit(-1);
-    } else if (argc != 2) {
-        std::cerr << "Wrong number of arguments. One required," << argc << 
-        " given. Exiting" << std::endl;
     }
 
-    std::cout.setf(std::ios::unitbuf);
+    if (!seeded) {
+        seed = time(NULL);
+    }
 
-    char * file_path = argv[1];
+    if (ensemble_size > 0) {
+        EnsembleSummary ensemble_summary(summary);
+        if (!ensemble_summary.valid()) {
+            std::cerr << "Unknown summary " << summary << ", expected concat, histogram, mean or sum" << std::endl;
+            exit(-1);
+        }
+        Ensemble<EmbeddedVM> ensemble(workers);
+        ensemble.configure(options);
+        return ensemble.execute(file_path, ensemble_size, seed, input_path, max_instructions, ensemble_summary);
+    }
+
+    if (stream) {
+        Stream<EmbeddedVM> records(workers);
+        records.configure(options);
+        return records.execute(file_path, delimiter, seed, max_instructions);
+    }
+
+    std::cout.setf(std::ios::unitbuf);
 
     VM vm;
+
+    if (analyze) {
+        const ProgramAnalysis* analysis = vm.analyze(file_path);
+        if (analysis == NULL) {
+            std::cerr << vm.error_message() << std::endl;
+            exit(-1);
+        }
+        analysis->report(std::cout);
+        if (dot_path != NULL) {
+            std::ofstream dot(dot_path);
+            analysis->write_dot(dot);
+        }
+        return 0;
+    }
+
+    options(vm);
+    vm.set_seed(seed);
+
+    std::unique_ptr<PerfCounters> counters;
+    if (perf_counters) {
+        counters.reset(new PerfCounters());
+        vm.set_perf_counters(counters.get());
+    }
+
     //vm.load_program(file_path);
     //vm.print_program();
-    vm.execute(file_path);
-    
-    return 0;
-}
\ No newline at end of file
+    Sampler sampler;
+    if (sample_path != NULL) {
+        vm.attach_sampler(sampler);
+        if (!sampler.start(sample_hz, sample_paused, sample_path)) {
+            sample_path = NULL;
+        }
+    }
+
+    Tracer tracer;
+    if (trace_path != NULL) {
+        if (!tracer.start(trace_path, trace_records)) {
+            exit(-1);
+        }
+        vm.set_tracer(&tracer);
+    }
+
+    std::unique_ptr<Profile> profile;
+    if (profile_path != NULL) {
+        profile.reset(new Profile(profile_path));
+        vm.set_profile(profile.get());
+    }
+
+    RunStatus status = vm.execute(file_path);
+
+    if (huge_pages) {
+        vm.report_pages(std::cerr);
+    }
+
+    if (sample_path != NULL) {
+        sampler.stop();
+        std::ofstream folded(sample_path);
+        sampler.report(folded);
+        std::cerr << sampler.samples() << " samples, " << sampler.dropped() << " dropped" << std::endl;
+    }
+
+    if (counters) {
+        counters->report(std::cerr, "execute", vm.stats().instructions);
+    }
+
+    return is_error(status) ? -1 : 0;
+}
@@ -0,0 +1,106 @@
+#include "../common/include/protocol.hpp"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+// Sends a program to a befunge93 or befunge93+ running with --serve
+// and prints its output. The exit code is the RunStatus, 0 once the
+// program reached @.
+static std::string read_file(const char* path) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        std::cerr << "Unable to open " << path << std::endl;
+        exit(-1);
+    }
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+int main(int argc, char *argv[]) {
+    const char * socket_path = NULL;
+    const char * file_path = NULL;
+    const char * input_path = NULL;
+    Request request;
+    int repeat = 1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--input") == 0 && i + 1 < argc) {
+            input_path = argv[++i];
+        } else if (strcmp(argv[i], "--id") == 0 && i + 1 < argc) {
+            // run a program the server already has
+            request.program_id = strtoull(argv[++i], NULL, 16);
+        } else if (strcmp(argv[i], "--max-instructions") == 0 && i + 1 < argc) {
+            request.max_instructions = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--max-output") == 0 && i + 1 < argc) {
+            request.max_output = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            // send it this many times and report the mean latency
+            repeat = std::max(1, atoi(argv[++i]));
+        } else if (socket_path == NULL) {
+            socket_path = argv[i];
+        } else if (file_path == NULL) {
+            file_path = argv[i];
+        } else {
+            std::cerr << "Unexpected argument " << argv[i] << ". Exiting" << std::endl;
+            exit(-1);
+        }
+    }
+
+    if (socket_path == NULL || (file_path == NULL && request.program_id == 0)) {
+        std::cerr << "usage: befunge_client SOCKET (FILE | --id ID) [--input FILE] "
+                     "[--max-instructions N] [--max-output BYTES] [--repeat N]" << std::endl;
+        exit(-1);
+    }
+
+    if (file_path != NULL) {
+        request.program = read_file(file_path);
+    }
+    if (input_path != NULL) {
+        request.input = read_file(input_path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_path, sizeof(address.sun_path) - 1);
+    if (fd < 0 || connect(fd, (sockaddr*)&address, sizeof(address)) < 0) {
+        std::cerr << "Unable to connect to " << socket_path << ": " << strerror(errno) << std::endl;
+        exit(-1);
+    }
+
+    Response response;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repeat; i++) {
+        if (!write_request(fd, request) || !read_response(fd, response)) {
+            std::cerr << "Connection to the server lost" << std::endl;
+            exit(-1);
+        }
+        if (i == 0 && response.program_id != 0) {
+            // later requests only name the program
+            request.program.clear();
+            request.program_id = response.program_id;
+        }
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    close(fd);
+
+    std::cout << response.output;
+    std::cout.flush();
+    if (!response.error.empty()) {
+        std::cerr << response.error << std::endl;
+    }
+    if (repeat > 1) {
+        std::cerr << "program " << std::hex << response.program_id << std::dec << ", " << repeat <<
+        " requests, " << elapsed.count() / repeat << " us each" << std::endl;
+    }
+
+    return response.status;
+}
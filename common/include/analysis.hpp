@@ -0,0 +1,617 @@
+#ifndef INCLUDE_ANALYSIS_HPP
+    #define INCLUDE_ANALYSIS_HPP
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <string>
+#include "bytecode.hpp"
+
+// Static analysis of a loaded program grid.
+//
+// The control flow graph has one node per (cell, direction)
+// the PC can be in and is explored from (0,0) moving right.
+// Along it a small abstract stack is propagated: bounds on the
+// depth and the values of the top few cells where they are
+// constants. This is enough to
+//   - find the reachable cells and the cells read as strings,
+//   - resolve the targets of p when they are pushed as constants,
+//     and so decide whether p can ever rewrite code (if not, the
+//     grid is static for the whole run),
+//   - bound the stack depth where it cannot grow without bound,
+//   - find the cells whose pops can never hit an empty stack.
+class ProgramAnalysis {
+    public:
+        static const int width = 80;
+        static const int height = 25;
+        static const int unbounded = -1;
+
+    private:
+        static const int n_states = width * height * 4;
+
+        // loops are widened after this many changes of a node
+        static const int widen_after = 8;
+
+        // constants outside this range are forgotten so the
+        // folding agrees with both 32 and 64 bit stacks
+        static const long long max_constant = 1LL << 30;
+
+        struct AbstractStack {
+            static const int tracked = 4;
+
+            int lo, hi; // depth bounds, hi may be unbounded
+            bool known[tracked];
+            long long value[tracked];
+
+            // the empty stack, popping it yields zeros
+            static AbstractStack empty() {
+                AbstractStack s;
+                s.lo = s.hi = 0;
+                for (int i = 0; i < tracked; i++) {
+                    s.known[i] = true;
+                    s.value[i] = 0;
+                }
+                return s;
+            }
+
+            void push_unknown() {
+                push(false, 0);
+            }
+
+            void push(bool is_known, long long v) {
+                if (is_known && (v > max_constant || v < -max_constant)) {
+                    is_known = false;
+                }
+
+                for (int i = tracked - 1; i > 0; i--) {
+                    known[i] = known[i - 1];
+                    value[i] = value[i - 1];
+                }
+                known[0] = is_known;
+                value[0] = v;
+
+                ++lo;
+                if (hi != unbounded) {
+                    ++hi;
+                }
+            }
+
+            // pops the top, is_known and v describe it
+            void pop(bool& is_known, long long& v) {
+                is_known = known[0];
+                v = value[0];
+
+                // what slides into the last tracked slot is an
+                // implicit zero only if the stack is that shallow
+                bool bottom_zero = hi != unbounded && hi <= tracked;
+                for (int i = 0; i < tracked - 1; i++) {
+                    known[i] = known[i + 1];
+                    value[i] = value[i + 1];
+                }
+                known[tracked - 1] = bottom_zero;
+                value[tracked - 1] = 0;
+
+                lo = lo > 0 ? lo - 1 : 0;
+                if (hi != unbounded && hi > 0) {
+                    --hi;
+                }
+            }
+
+            void pop() {
+                bool is_known;
+                long long v;
+                pop(is_known, v);
+            }
+
+            // least upper bound, true if this changed
+            bool join(const AbstractStack& other) {
+                bool changed = false;
+
+                if (other.lo < lo) {
+                    lo = other.lo;
+                    changed = true;
+                }
+                if (hi != unbounded && (other.hi == unbounded || other.hi > hi)) {
+                    hi = other.hi;
+                    changed = true;
+                }
+                for (int i = 0; i < tracked; i++) {
+                    if (known[i] && (!other.known[i] || other.value[i] != value[i])) {
+                        known[i] = false;
+                        changed = true;
+                    }
+                }
+
+                return changed;
+            }
+        };
+
+        struct Successor {
+            int state;
+            AbstractStack stack;
+        };
+
+        const unsigned int (*program)[width];
+        bool with_heap;
+
+        std::vector<AbstractStack> in;
+        std::vector<bool> reached;
+        std::vector<int> changes;
+        std::vector<std::vector<int>> edges;
+        std::vector<int> visited; // the states reached
+
+        bool cell_reachable[height][width];
+        bool cell_string[height][width];
+        bool cell_safe_pops[height][width];
+
+        struct PutTarget {
+            int from_x, from_y;
+            bool known;
+            long long x, y;
+        };
+        std::vector<PutTarget> puts;
+
+        bool static_grid;
+        int depth_bound;
+
+        static int state_of(int x, int y, DIRECTION d) {
+            return (y * width + x) * 4 + d;
+        }
+
+        static char to_char(unsigned int a) {
+            return a < 1000 ? charset[a] : (char)(a - 1000);
+        }
+
+        unsigned int opcode(int x, int y) {
+            unsigned int op = program[y][x];
+            if (!with_heap && op >= CONS_OP && op <= VLEN_OP) {
+                return N_COMMANDS;
+            }
+            return op < N_COMMANDS ? op : (unsigned int)N_COMMANDS;
+        }
+
+        // how many values the instruction pops
+        static int pops_of(unsigned int op) {
+            switch (op) {
+            case ADD_OP: case SUB_OP: case MUL_OP: case DIV_OP: case MOD_OP:
+            case GT_OP: case GET_OP: case CONS_OP: case VGET_OP:
+                return 2;
+            case PUT_OP: case VSET_OP:
+                return 3;
+            case NOT_OP: case HORIF_OP: case VERTIF_OP: case POP_OP:
+            case OUTI_OP: case OUTC_OP: case HEAD_OP: case TAIL_OP:
+            case VECTOR_OP: case VLEN_OP:
+                return 1;
+            default:
+                return 0;
+            }
+        }
+
+        void add(std::vector<Successor>& next, PC pc, DIRECTION d, const AbstractStack& s) {
+            pc.move(d);
+            Successor succ = {state_of(pc.x, pc.y, d), s};
+            next.push_back(succ);
+        }
+
+        // abstract execution of the instruction at x,y entered moving d
+        void transfer(int x, int y, DIRECTION d, AbstractStack s, std::vector<Successor>& next) {
+            PC pc;
+            pc.x = x;
+            pc.y = y;
+
+            unsigned int op = opcode(x, y);
+            bool k1, k2;
+            long long v1, v2;
+
+            if (op <= NUM9_OP) {
+                s.push(true, op - NUM0_OP);
+                add(next, pc, d, s);
+                return;
+            }
+
+            switch (op) {
+            case ADD_OP: case SUB_OP: case MUL_OP: case DIV_OP: case MOD_OP: case GT_OP:
+                s.pop(k2, v2);
+                s.pop(k1, v1);
+                if ((op == DIV_OP || op == MOD_OP) && k2 && v2 == 0) {
+                    // division by zero stops the VM
+                    return;
+                }
+                if (k1 && k2) {
+                    long long r = 0;
+                    switch (op) {
+                    case ADD_OP: r = v1 + v2; break;
+                    case SUB_OP: r = v1 - v2; break;
+                    case MUL_OP: r = v1 * v2; break;
+                    case DIV_OP: r = v1 / v2; break;
+                    case MOD_OP: r = v1 % v2; break;
+                    default: r = v1 > v2 ? 1 : 0; break;
+                    }
+                    s.push(true, r);
+                } else {
+                    s.push_unknown();
+                }
+                add(next, pc, d, s);
+                return;
+            case NOT_OP:
+                s.pop(k1, v1);
+                s.push(k1, v1 != 0 ? 0 : 1);
+                add(next, pc, d, s);
+                return;
+            case RIGHT_OP:
+                add(next, pc, RIGHT, s);
+                return;
+            case LEFT_OP:
+                add(next, pc, LEFT, s);
+                return;
+            case UP_OP:
+                add(next, pc, UP, s);
+                return;
+            case DOWN_OP:
+                add(next, pc, DOWN, s);
+                return;
+            case RAND_OP:
+                add(next, pc, UP, s);
+                add(next, pc, DOWN, s);
+                add(next, pc, LEFT, s);
+                add(next, pc, RIGHT, s);
+                return;
+            case HORIF_OP:
+                s.pop(k1, v1);
+                if (!k1 || v1 == 0) {
+                    add(next, pc, RIGHT, s);
+                }
+                if (!k1 || v1 != 0) {
+                    add(next, pc, LEFT, s);
+                }
+                return;
+            case VERTIF_OP:
+                s.pop(k1, v1);
+                if (!k1 || v1 == 0) {
+                    add(next, pc, DOWN, s);
+                }
+                if (!k1 || v1 != 0) {
+                    add(next, pc, UP, s);
+                }
+                return;
+            case STRING_OP:
+                // walk the literal, on a line without a second
+                // quote it wraps around the whole line and closes
+                // at the opening quote
+                pc.move(d);
+                for (int steps = 0; steps < width * height; steps++) {
+                    cell_string[pc.y][pc.x] = true;
+                    if (program[pc.y][pc.x] == STRING_OP) {
+                        add(next, pc, d, s);
+                        return;
+                    }
+                    s.push(true, to_char(program[pc.y][pc.x]));
+                    pc.move(d);
+                }
+                return;
+            case DUP_OP:
+                // an empty stack gets a single zero
+                if (s.lo == 0) {
+                    bool may_have_values = s.hi != 0;
+                    s.push(s.known[0], s.value[0]);
+                    if (may_have_values) {
+                        s.hi = s.hi == unbounded ? unbounded : s.hi + 1;
+                    }
+                } else {
+                    s.pop(k1, v1);
+                    s.push(k1, v1);
+                    s.push(k1, v1);
+                }
+                add(next, pc, d, s);
+                return;
+            case SWAP_OP:
+                s.pop(k2, v2);
+                s.pop(k1, v1);
+                s.push(k2, v2);
+                s.push(k1, v1);
+                add(next, pc, d, s);
+                return;
+            case POP_OP: case OUTI_OP: case OUTC_OP:
+                s.pop();
+                add(next, pc, d, s);
+                return;
+            case BRIDGE_OP:
+                pc.move(d);
+                add(next, pc, d, s);
+                return;
+            case GET_OP:
+                s.pop();
+                s.pop();
+                s.push_unknown();
+                add(next, pc, d, s);
+                return;
+            case PUT_OP:
+                s.pop();
+                s.pop();
+                s.pop();
+                add(next, pc, d, s);
+                return;
+            case INPUTI_OP: case INPUTC_OP:
+                s.push_unknown();
+                add(next, pc, d, s);
+                return;
+            case END_OP:
+                return;
+            case CONS_OP:
+                s.pop();
+                s.pop();
+                s.push_unknown();
+                add(next, pc, d, s);
+                return;
+            case HEAD_OP: case TAIL_OP: case VECTOR_OP: case VLEN_OP:
+                s.pop();
+                s.push_unknown();
+                add(next, pc, d, s);
+                return;
+            case VGET_OP:
+                s.pop();
+                s.pop();
+                s.push_unknown();
+                add(next, pc, d, s);
+                return;
+            case VSET_OP:
+                s.pop();
+                s.pop();
+                s.pop();
+                add(next, pc, d, s);
+                return;
+            case NULL_OP:
+                add(next, pc, d, s);
+                return;
+            default:
+                // invalid command stops the VM
+                return;
+            }
+        }
+
+        void widen(AbstractStack& s) {
+            s.lo = 0;
+            s.hi = unbounded;
+        }
+
+        // a state seen for the first time, the tables keep what
+        // the last run left in states it did not reach
+        void reach(int state, const AbstractStack& s) {
+            reached[state] = true;
+            in[state] = s;
+            changes[state] = 0;
+            edges[state].clear();
+            visited.push_back(state);
+        }
+
+        void explore() {
+            if ((int)in.size() != n_states) {
+                in.resize(n_states);
+                reached.assign(n_states, false);
+                changes.resize(n_states);
+                edges.resize(n_states);
+            }
+            for (int state : visited) {
+                reached[state] = false;
+            }
+            visited.clear();
+
+            std::vector<int> worklist;
+            std::vector<bool> queued(n_states, false);
+
+            int start = state_of(0, 0, RIGHT);
+            reach(start, AbstractStack::empty());
+            worklist.push_back(start);
+            queued[start] = true;
+
+            std::vector<Successor> next;
+            while (!worklist.empty()) {
+                int state = worklist.back();
+                worklist.pop_back();
+                queued[state] = false;
+
+                int cell = state / 4;
+                next.clear();
+                transfer(cell % width, cell / width, (DIRECTION)(state % 4), in[state], next);
+
+                for (Successor& succ : next) {
+                    bool changed;
+                    if (!reached[succ.state]) {
+                        reach(succ.state, succ.stack);
+                        changed = true;
+                    } else {
+                        changed = in[succ.state].join(succ.stack);
+                        if (changed && ++changes[succ.state] > widen_after) {
+                            widen(in[succ.state]);
+                        }
+                    }
+
+                    std::vector<int>& out = edges[state];
+                    bool seen = false;
+                    for (int e : out) {
+                        seen = seen || e == succ.state;
+                    }
+                    if (!seen) {
+                        out.push_back(succ.state);
+                    }
+
+                    if (changed && !queued[succ.state]) {
+                        queued[succ.state] = true;
+                        worklist.push_back(succ.state);
+                    }
+                }
+            }
+        }
+
+        void summarize() {
+            depth_bound = 0;
+            static_grid = true;
+
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    cell_reachable[y][x] = false;
+                    cell_safe_pops[y][x] = true;
+                }
+            }
+
+            // in state order, p targets are reported by position
+            std::sort(visited.begin(), visited.end());
+            for (int state : visited) {
+                int x = (state / 4) % width;
+                int y = (state / 4) / width;
+                const AbstractStack& s = in[state];
+                unsigned int op = opcode(x, y);
+
+                cell_reachable[y][x] = true;
+                if (s.lo < pops_of(op)) {
+                    cell_safe_pops[y][x] = false;
+                }
+
+                if (s.hi == unbounded || depth_bound == unbounded) {
+                    depth_bound = unbounded;
+                } else if (s.hi > depth_bound) {
+                    depth_bound = s.hi;
+                }
+
+                if (op == PUT_OP) {
+                    PutTarget target = {x, y, s.known[0] && s.known[1], s.value[1], s.value[0]};
+                    puts.push_back(target);
+                }
+            }
+
+            for (PutTarget& target : puts) {
+                if (!target.known) {
+                    static_grid = false;
+                } else if (target.x >= 0 && target.x < width && target.y >= 0 && target.y < height &&
+                           (cell_reachable[target.y][target.x] || cell_string[target.y][target.x])) {
+                    static_grid = false;
+                }
+            }
+        }
+
+        static const char* direction_name(int d) {
+            static const char* names[] = {"up", "down", "left", "right"};
+            return names[d];
+        }
+
+    public:
+        ProgramAnalysis(): program(NULL), with_heap(false), static_grid(false), depth_bound(unbounded) {}
+
+        // analyze a grid of bytecodes, heap instructions
+        // are only commands when has_heap is set
+        void run(const unsigned int grid[height][width], bool has_heap) {
+            program = grid;
+            with_heap = has_heap;
+            puts.clear();
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    cell_string[y][x] = false;
+                }
+            }
+
+            explore();
+            summarize();
+        }
+
+        bool reachable(int x, int y) const {
+            return cell_reachable[y][x];
+        }
+
+        bool read_as_string(int x, int y) const {
+            return cell_string[y][x];
+        }
+
+        // no p can ever write to a cell that is executed or read
+        // by a string literal, the grid the VM runs never changes
+        bool is_static_grid() const {
+            return static_grid;
+        }
+
+        // every time the cell runs the stack holds at least as
+        // many values as it pops
+        bool pops_safe(int x, int y) const {
+            return cell_reachable[y][x] && cell_safe_pops[y][x];
+        }
+
+        // largest stack depth on any path, unbounded if a loop can grow it
+        int max_stack_depth() const {
+            return depth_bound;
+        }
+
+        void report(std::ostream& out) const {
+            int n_reachable = 0, n_strings = 0, n_safe = 0;
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    n_reachable += cell_reachable[y][x];
+                    n_strings += cell_string[y][x];
+                    n_safe += cell_reachable[y][x] && cell_safe_pops[y][x] && pops_of(program[y][x]) > 0;
+                }
+            }
+
+            out << "reachable cells: " << n_reachable << std::endl;
+            out << "string cells: " << n_strings << std::endl;
+            out << "cells with unchecked pops: " << n_safe << std::endl;
+
+            out << "max stack depth: ";
+            if (depth_bound == unbounded) {
+                out << "unbounded" << std::endl;
+            } else {
+                out << depth_bound << std::endl;
+            }
+
+            out << "p instructions: " << puts.size() << std::endl;
+            for (const PutTarget& target : puts) {
+                out << "  p at " << target.from_x << "," << target.from_y << " -> ";
+                if (!target.known) {
+                    out << "unknown target" << std::endl;
+                } else {
+                    out << target.x << "," << target.y;
+                    bool in_grid = target.x >= 0 && target.x < width && target.y >= 0 && target.y < height;
+                    if (in_grid && cell_reachable[target.y][target.x]) {
+                        out << " (executed cell)";
+                    } else if (in_grid && cell_string[target.y][target.x]) {
+                        out << " (string cell)";
+                    }
+                    out << std::endl;
+                }
+            }
+            out << "static grid: " << (static_grid ? "yes" : "no") << std::endl;
+
+            // the grid, unreachable cells shown as blanks
+            out << "reachable code:" << std::endl;
+            for (int y = 0; y < height; y++) {
+                std::string line;
+                for (int x = 0; x < width; x++) {
+                    line += cell_reachable[y][x] || cell_string[y][x] ? to_char(program[y][x]) : ' ';
+                }
+                line.erase(line.find_last_not_of(' ') + 1);
+                out << line << std::endl;
+            }
+        }
+
+        // control flow graph of the reachable (cell, direction) nodes
+        void write_dot(std::ostream& out) const {
+            out << "digraph befunge {" << std::endl;
+            out << "    node [shape=box, fontname=monospace];" << std::endl;
+            for (int state = 0; state < n_states; state++) {
+                if (!reached[state]) {
+                    continue;
+                }
+
+                int x = (state / 4) % width;
+                int y = (state / 4) / width;
+                char c = to_char(program[y][x]);
+
+                out << "    s" << state << " [label=\"" << x << "," << y << " " << direction_name(state % 4) << "\\n";
+                if (c == '"' || c == '\\') {
+                    out << '\\';
+                }
+                out << c << "\"];" << std::endl;
+
+                for (int succ : edges[state]) {
+                    out << "    s" << state << " -> s" << succ << ";" << std::endl;
+                }
+            }
+            out << "}" << std::endl;
+        }
+};
+#endif
@@ -0,0 +1,133 @@
+#ifndef INCLUDE_BUFFERIO_HPP
+    #define INCLUDE_BUFFERIO_HPP
+#include <string>
+#include <functional>
+#include <cctype>
+
+// I/O policy for embedding the VM in a host process.
+//
+// Input is fed by the caller in chunks. & and ~ wait for a whole
+// line, as they would on a terminal, and run() reports
+// WAITING_FOR_INPUT until more is fed or the input is closed,
+// after which reads see the end of input.
+//
+// Output collects in a buffer. With a sink attached the buffer is
+// handed over without copying whenever it fills up and at the end
+// of every run(), without one the caller reads output() and clears
+// it when done.
+class BufferIO {
+    public:
+        typedef std::function<void(const char* data, size_t length)> Sink;
+
+    private:
+        static const size_t flush_at = 1 << 12;
+
+        std::string input;
+        size_t read_pos;
+        bool input_closed;
+
+        std::string out;
+        Sink sink;
+
+        void skip_consumed() {
+            // keep the buffer from growing with what was read
+            if (read_pos > flush_at && read_pos * 2 > input.size()) {
+                input.erase(0, read_pos);
+                read_pos = 0;
+            }
+        }
+
+    public:
+        BufferIO(): read_pos(0), input_closed(false) {}
+
+        void feed(const char* data, size_t length) {
+            skip_consumed();
+            input.append(data, length);
+        }
+
+        void feed(const std::string& data) {
+            feed(data.data(), data.size());
+        }
+
+        // no more input, reads past the fed data see the end
+        void close_input() {
+            input_closed = true;
+        }
+
+        void set_sink(Sink output_sink) {
+            sink = output_sink;
+        }
+
+        const std::string& output() {
+            return out;
+        }
+
+        void clear_output() {
+            out.clear();
+        }
+
+        // forget the input and output of the last program
+        void reset() {
+            input.clear();
+            read_pos = 0;
+            input_closed = false;
+            out.clear();
+        }
+
+        bool input_ready() {
+            return input_closed || input.find('\n', read_pos) != std::string::npos;
+        }
+
+        // like std::cin >> value: skips blanks, 0 when no number follows
+        template <typename Value>
+        void read_int(Value& value) {
+            while (read_pos < input.size() && isspace((unsigned char)input[read_pos])) {
+                ++read_pos;
+            }
+
+            bool negative = false;
+            if (read_pos < input.size() && (input[read_pos] == '-' || input[read_pos] == '+')) {
+                negative = input[read_pos] == '-';
+                ++read_pos;
+            }
+
+            value = 0;
+            while (read_pos < input.size() && isdigit((unsigned char)input[read_pos])) {
+                value = value * 10 + (input[read_pos] - '0');
+                ++read_pos;
+            }
+
+            if (negative) {
+                value = -value;
+            }
+        }
+
+        // -1 at end of input
+        int read_char() {
+            return read_pos < input.size() ? input[read_pos++] : -1;
+        }
+
+        template <typename Value>
+        void write_int(Value value) {
+            out += std::to_string(value);
+            if (sink && out.size() >= flush_at) {
+                flush();
+            }
+        }
+
+        void write_char(char c) {
+            out += c;
+            if (sink && out.size() >= flush_at) {
+                flush();
+            }
+        }
+
+        void flush() {
+            if (sink && !out.empty()) {
+                sink(out.data(), out.size());
+                out.clear();
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef INCLUDE_BYTECODE_HPP
+    #define INCLUDE_BYTECODE_HPP
+
+// The grid as the VM sees it: directions, the program
+// counter and the bytecode every command decodes to.
+
+enum DIRECTION {
+        UP = 0,
+        DOWN,
+        LEFT,
+        RIGHT
+};
+
+struct PC {
+
+    int x,y;
+
+    static const int maxlimitx = 79;
+    static const int maxlimity = 24;
+
+    int limitx = maxlimitx;
+    int limity = maxlimity;
+
+
+    void move(DIRECTION d) {
+        switch (d)
+        {
+        case UP:
+            y = y - 1  >= 0 ? y - 1: limity;
+            break;
+        case DOWN:
+            y = y + 1  <= limity ? y + 1: 0;
+            break;
+        case RIGHT:
+            x = x + 1  <= limitx ? x + 1: 0;
+            break;
+        case LEFT:
+            x = x - 1 >= 0 ? x - 1: limitx;
+            break;
+        default:
+            break;
+        }
+    }
+
+
+    PC(): x(0), y(0) {}
+};
+
+// bytecode of every command, in charset order
+enum OPCODE {
+        NUM0_OP = 0,
+        NUM1_OP,
+        NUM2_OP,
+        NUM3_OP,
+        NUM4_OP,
+        NUM5_OP,
+        NUM6_OP,
+        NUM7_OP,
+        NUM8_OP,
+        NUM9_OP,
+        ADD_OP,
+        SUB_OP,
+        MUL_OP,
+        DIV_OP,
+        MOD_OP,
+        NOT_OP,
+        GT_OP,
+        RIGHT_OP,
+        LEFT_OP,
+        UP_OP,
+        DOWN_OP,
+        RAND_OP,
+        HORIF_OP,
+        VERTIF_OP,
+        STRING_OP,
+        DUP_OP,
+        SWAP_OP,
+        POP_OP,
+        OUTI_OP,
+        OUTC_OP,
+        BRIDGE_OP,
+        GET_OP,
+        PUT_OP,
+        INPUTI_OP,
+        INPUTC_OP,
+        END_OP,
+        CONS_OP,
+        HEAD_OP,
+        TAIL_OP,
+        VECTOR_OP,
+        VGET_OP,
+        VSET_OP,
+        VLEN_OP,
+        NULL_OP,
+        N_COMMANDS
+};
+
+// cells the static analysis proved to never pop an empty
+// stack run as bytecode + UNCHECKED_BASE, see BasicVM
+static const int UNCHECKED_BASE = N_COMMANDS + 1;
+static const int N_DISPATCH = UNCHECKED_BASE + N_COMMANDS;
+
+// all valid commands, c h t a r w and l only with a heap
+static constexpr char charset[] = "0123456789+-*/%!`><^v?_|\":\\$.,#gp&~@chtarwl ";
+
+// bytecode of every char, without and with a heap. Chars that
+// are not commands decode to 1000 + the char, so that decoding
+// can be undone
+struct BytecodeTable {
+    unsigned int codes[2][256];
+};
+
+constexpr BytecodeTable make_bytecode_table() {
+    BytecodeTable table{};
+    for (int heap = 0; heap < 2; heap++) {
+        for (int c = 0; c < 256; c++) {
+            table.codes[heap][c] = 1000 + c;
+        }
+        for (int op = 0; op < N_COMMANDS; op++) {
+            if (heap || op < CONS_OP || op > VLEN_OP) {
+                table.codes[heap][(unsigned char)charset[op]] = op;
+            }
+        }
+    }
+    return table;
+}
+
+static constexpr BytecodeTable bytecode_table = make_bytecode_table();
+#endif
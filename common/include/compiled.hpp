@@ -0,0 +1,567 @@
+#ifndef INCLUDE_COMPILED_HPP
+    #define INCLUDE_COMPILED_HPP
+#include <array>
+#include <utility>
+#include <climits>
+#include <type_traits>
+#include "vmcore.hpp"
+
+// Programs compiled into the host binary.
+//
+// embed_program() decodes a source held in a constexpr char array
+// at compile time, with the same rules as load_source():
+//   static constexpr char source[] = R"(...)";
+//   static constexpr EmbeddedProgram program = embed_program(source);
+//   CompiledVM<program, EmbeddedVM> vm;
+// The array may also be filled from a file, e.g. with the bytes
+// `xxd -i` prints and a trailing 0.
+//
+// CompiledVM then instantiates a function per entry state, that is
+// per cell and direction the PC can arrive at from a branch, and
+// from there follows the grid in templates: every cell up to the
+// next branch is its own instantiation, inlined into the previous
+// one, with the direction, the next cell and string literals worked
+// out by the compiler. Digits stay template arguments instead of
+// being pushed (two at most), so arithmetic on them folds and
+// arithmetic with one of them runs with a constant operand. A
+// trampoline calls the entry of the next state.
+//
+// Chains stop at max_chain cells and before & or ~, so that a run
+// waiting for input resumes at an entry. The heap instructions of
+// befunge93+ run one at a time on the interpreter. A p that changes
+// a cell the compiled code runs through hands the VM over to the
+// interpreter for the rest of the run. stats() counts only the
+// instructions the interpreter ran.
+struct EmbeddedProgram {
+    unsigned int grid[25][80];
+    bool heap; // decoded with c h t a r w l
+    bool fits; // false when the source does not fit the grid
+};
+
+constexpr EmbeddedProgram embed_program(const char* source, bool heap = false) {
+    EmbeddedProgram program{};
+    program.heap = heap;
+    for (int y = 0; y <= PC::maxlimity; y++) {
+        for (int x = 0; x <= PC::maxlimitx; x++) {
+            program.grid[y][x] = NULL_OP;
+        }
+    }
+
+    int i = 0, j = 0;
+    for (const char* c = source; *c != '\0' && j <= PC::maxlimitx && i <= PC::maxlimity; ++c) {
+        if (*c != '\n') {
+            program.grid[i][j++] = bytecode_table.codes[heap][(unsigned char)*c];
+        } else {
+            ++i;
+            j = 0;
+        }
+    }
+    program.fits = j <= PC::maxlimitx && i <= PC::maxlimity;
+    return program;
+}
+
+// the entry states of a program and the cells compiled code goes through
+struct CompiledPlan {
+    // cells a chain goes through before returning to the trampoline
+    static const int max_chain = 32;
+    static const int max_states = 25 * 80 * 4;
+
+    int entries;
+    short x[max_states], y[max_states];
+    unsigned char dir[max_states];
+    short id[25][80][4]; // -1 when not an entry
+    bool code[25][80];
+
+    static constexpr int next_x(int x, int d) {
+        return d == RIGHT ? (x == PC::maxlimitx ? 0 : x + 1) : d == LEFT ? (x == 0 ? PC::maxlimitx : x - 1) : x;
+    }
+
+    static constexpr int next_y(int y, int d) {
+        return d == DOWN ? (y == PC::maxlimity ? 0 : y + 1) : d == UP ? (y == 0 ? PC::maxlimity : y - 1) : y;
+    }
+
+    static constexpr bool is_heap_op(unsigned int op) {
+        return op >= CONS_OP && op <= VLEN_OP;
+    }
+
+    static constexpr int arrow_dir(unsigned int op) {
+        return op == RIGHT_OP ? RIGHT : op == LEFT_OP ? LEFT : op == UP_OP ? UP : DOWN;
+    }
+
+    static constexpr char to_char(unsigned int bytecode) {
+        return bytecode < 1000 ? charset[bytecode] : (char)(bytecode - 1000);
+    }
+
+    constexpr void add_entry(int at_x, int at_y, int d) {
+        if (id[at_y][at_x][d] < 0) {
+            id[at_y][at_x][d] = entries;
+            x[entries] = at_x;
+            y[entries] = at_y;
+            dir[entries] = d;
+            ++entries;
+        }
+    }
+};
+
+// a string literal, read once by the compiler
+struct EmbeddedLiteral {
+    char chars[80];
+    int length;
+    int exit_x, exit_y; // after the closing "
+};
+
+constexpr EmbeddedLiteral read_literal(const EmbeddedProgram& program, int x, int y, int d) {
+    EmbeddedLiteral literal{};
+    x = CompiledPlan::next_x(x, d);
+    y = CompiledPlan::next_y(y, d);
+    while (program.grid[y][x] != (unsigned int)STRING_OP) {
+        literal.chars[literal.length++] = CompiledPlan::to_char(program.grid[y][x]);
+        x = CompiledPlan::next_x(x, d);
+        y = CompiledPlan::next_y(y, d);
+    }
+    literal.exit_x = CompiledPlan::next_x(x, d);
+    literal.exit_y = CompiledPlan::next_y(y, d);
+    return literal;
+}
+
+// walks every chain the way CompiledVM::step() compiles it
+constexpr CompiledPlan plan_program(const EmbeddedProgram& program) {
+    CompiledPlan plan{};
+    for (int y = 0; y <= PC::maxlimity; y++) {
+        for (int x = 0; x <= PC::maxlimitx; x++) {
+            for (int d = 0; d < 4; d++) {
+                plan.id[y][x][d] = -1;
+            }
+        }
+    }
+
+    plan.add_entry(0, 0, RIGHT);
+    for (int e = 0; e < plan.entries; e++) {
+        int x = plan.x[e], y = plan.y[e], d = plan.dir[e];
+        for (int depth = 0; ; depth++) {
+            unsigned int op = program.grid[y][x];
+            if (depth == CompiledPlan::max_chain || (depth > 0 && (op == INPUTI_OP || op == INPUTC_OP))) {
+                plan.add_entry(x, y, d);
+                break;
+            }
+            plan.code[y][x] = true;
+
+            if (op == HORIF_OP) {
+                plan.add_entry(CompiledPlan::next_x(x, RIGHT), y, RIGHT);
+                plan.add_entry(CompiledPlan::next_x(x, LEFT), y, LEFT);
+                break;
+            } else if (op == VERTIF_OP) {
+                plan.add_entry(x, CompiledPlan::next_y(y, DOWN), DOWN);
+                plan.add_entry(x, CompiledPlan::next_y(y, UP), UP);
+                break;
+            } else if (op == RAND_OP) {
+                for (int to = 0; to < 4; to++) {
+                    plan.add_entry(CompiledPlan::next_x(x, to), CompiledPlan::next_y(y, to), to);
+                }
+                break;
+            } else if (CompiledPlan::is_heap_op(op)) {
+                plan.add_entry(CompiledPlan::next_x(x, d), CompiledPlan::next_y(y, d), d);
+                break;
+            } else if (op == END_OP || op >= (unsigned int)N_COMMANDS) {
+                break;
+            }
+
+            if (op == RIGHT_OP || op == LEFT_OP || op == UP_OP || op == DOWN_OP) {
+                d = CompiledPlan::arrow_dir(op);
+            } else if (op == BRIDGE_OP) {
+                x = CompiledPlan::next_x(x, d);
+                y = CompiledPlan::next_y(y, d);
+            } else if (op == STRING_OP) {
+                EmbeddedLiteral literal = read_literal(program, x, y, d);
+                for (int i = 0; i <= literal.length; i++) {
+                    x = CompiledPlan::next_x(x, d);
+                    y = CompiledPlan::next_y(y, d);
+                    plan.code[y][x] = true;
+                }
+            }
+            x = CompiledPlan::next_x(x, d);
+            y = CompiledPlan::next_y(y, d);
+        }
+    }
+    return plan;
+}
+
+template <const EmbeddedProgram& Program, typename VM>
+class CompiledVM: public VM {
+    private:
+        typedef typename VM::value_type Value;
+        typedef typename std::make_unsigned<Value>::type Bits;
+
+        static_assert(Program.fits, "the embedded program does not fit the 80x25 grid");
+        static_assert(Program.heap == VM::memory_type::has_heap,
+                      "embed_program() needs heap set for befunge93+ and unset for befunge93");
+
+        // what a state returns instead of the next state
+        enum {
+            HALT = -1,
+            STOP = -2,    // status tells why
+            HAND_OFF = -3 // the interpreter runs the rest
+        };
+
+        static constexpr CompiledPlan plan = plan_program(Program);
+
+        static constexpr int next_x(int x, int d) {
+            return CompiledPlan::next_x(x, d);
+        }
+
+        static constexpr int next_y(int y, int d) {
+            return CompiledPlan::next_y(y, d);
+        }
+
+        template <int X, int Y, int D>
+        static constexpr int entry() {
+            constexpr int id = plan.id[Y][X][D];
+            static_assert(id >= 0, "a chain ends outside the planned entries");
+            return id;
+        }
+
+        static constexpr std::array<Value, 80> widen(const EmbeddedLiteral& literal) {
+            std::array<Value, 80> chars{};
+            for (int i = 0; i < literal.length; i++) {
+                chars[i] = literal.chars[i];
+            }
+            return chars;
+        }
+
+        static constexpr Value fold(unsigned int op, Value value1, Value value2) {
+            switch (op) {
+            case ADD_OP:
+                return (Value)((Bits)value1 + (Bits)value2);
+            case SUB_OP:
+                return (Value)((Bits)value1 - (Bits)value2);
+            case MUL_OP:
+                return (Value)((Bits)value1 * (Bits)value2);
+            case DIV_OP:
+                return value1 / value2;
+            case MOD_OP:
+                return value1 % value2;
+            default:
+                return value1 > value2 ? 1 : 0;
+            }
+        }
+
+        static constexpr bool is_binary(unsigned int op) {
+            return op == ADD_OP || op == SUB_OP || op == MUL_OP || op == DIV_OP || op == MOD_OP || op == GT_OP;
+        }
+
+        static int overflow(CompiledVM& vm) {
+            vm.fail(STACK_OVERFLOW, "Stack overflow");
+            return STOP;
+        }
+
+        // push the digits still held as template arguments
+        template <int N, Value K1, Value K2>
+        static bool flush(CompiledVM& vm) {
+            if constexpr (N >= 1) {
+                if (!vm.mem.push(K1)) {
+                    return false;
+                }
+            }
+            if constexpr (N == 2) {
+                if (!vm.mem.push(K2)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        template <int X, int Y, int D>
+        static void leave_at(CompiledVM& vm) {
+            vm.pc.x = X;
+            vm.pc.y = Y;
+            vm.curr_dir = (DIRECTION)D;
+        }
+
+        // the cell at X, Y entered going D, Depth cells into the
+        // chain, with N digits held: K1, or K1 then K2 on top
+        template <int X, int Y, int D, int Depth, int N, Value K1, Value K2>
+        static int step(CompiledVM& vm) {
+            constexpr unsigned int op = Program.grid[Y][X];
+            constexpr int NX = next_x(X, D), NY = next_y(Y, D);
+            constexpr Value top = N == 2 ? K2 : K1;
+            Value value1, value2;
+
+            if constexpr (Depth == CompiledPlan::max_chain || (Depth > 0 && (op == INPUTI_OP || op == INPUTC_OP))) {
+                if (!flush<N, K1, K2>(vm)) {
+                    return overflow(vm);
+                }
+                return entry<X, Y, D>();
+            } else if constexpr (op <= NUM9_OP) {
+                if constexpr (N == 0) {
+                    return step<NX, NY, D, Depth + 1, 1, (Value)op, 0>(vm);
+                } else if constexpr (N == 1) {
+                    return step<NX, NY, D, Depth + 1, 2, K1, (Value)op>(vm);
+                } else {
+                    if (!vm.mem.push(K1)) {
+                        return overflow(vm);
+                    }
+                    return step<NX, NY, D, Depth + 1, 2, K2, (Value)op>(vm);
+                }
+            } else if constexpr (is_binary(op) && N == 2 && !((op == DIV_OP || op == MOD_OP) && K2 <= 0)) {
+                return step<NX, NY, D, Depth + 1, 1, fold(op, K1, K2), 0>(vm);
+            } else if constexpr ((op == DIV_OP || op == MOD_OP) && N >= 1 && top == 0) {
+                if constexpr (N == 1) {
+                    vm.mem.pop();
+                }
+                leave_at<NX, NY, D>(vm);
+                vm.fail(DIVISION_BY_ZERO, "Error: Division by zero");
+                return STOP;
+            } else if constexpr (is_binary(op)) {
+                if (!flush<N - 1, K1, K2>(vm)) {
+                    return overflow(vm);
+                }
+                if constexpr (N >= 1) {
+                    value2 = top;
+                } else {
+                    value2 = vm.mem.pop();
+                }
+                value1 = vm.mem.pop();
+                if constexpr ((op == DIV_OP || op == MOD_OP) && N == 0) {
+                    if (value2 == 0) {
+                        leave_at<NX, NY, D>(vm);
+                        vm.fail(DIVISION_BY_ZERO, "Error: Division by zero");
+                        return STOP;
+                    }
+                }
+                if constexpr (op == ADD_OP) {
+                    vm.mem.push(value1 + value2);
+                } else if constexpr (op == SUB_OP) {
+                    vm.mem.push(value1 - value2);
+                } else if constexpr (op == MUL_OP) {
+                    vm.mem.push(value1 * value2);
+                } else if constexpr (op == DIV_OP) {
+                    vm.mem.push(value1 / value2);
+                } else if constexpr (op == MOD_OP) {
+                    vm.mem.push(value1 % value2);
+                } else {
+                    vm.mem.push(value1 > value2 ? 1 : 0);
+                }
+                return step<NX, NY, D, Depth + 1, 0, 0, 0>(vm);
+            } else if constexpr (op == NOT_OP && N >= 1) {
+                if constexpr (N == 1) {
+                    return step<NX, NY, D, Depth + 1, 1, (K1 != 0 ? 0 : 1), 0>(vm);
+                } else {
+                    return step<NX, NY, D, Depth + 1, 2, K1, (K2 != 0 ? 0 : 1)>(vm);
+                }
+            } else if constexpr (op == NOT_OP) {
+                value1 = vm.mem.pop();
+                vm.mem.push(value1 != 0 ? 0 : 1);
+                return step<NX, NY, D, Depth + 1, 0, 0, 0>(vm);
+            } else if constexpr (op == DUP_OP && N == 1) {
+                return step<NX, NY, D, Depth + 1, 2, K1, K1>(vm);
+            } else if constexpr (op == DUP_OP && N == 2) {
+                if (!vm.mem.push(K1)) {
+                    return overflow(vm);
+                }
+                return step<NX, NY, D, Depth + 1, 2, K2, K2>(vm);
+            } else if constexpr (op == DUP_OP) {
+                if (!vm.mem.dup()) {
+                    return overflow(vm);
+                }
+                return step<NX, NY, D, Depth + 1, 0, 0, 0>(vm);
+            } else if constexpr (op == SWAP_OP && N == 2) {
+                return step<NX, NY, D, Depth + 1, 2, K2, K1>(vm);
+            } else if constexpr (op == SWAP_OP) {
+                if (!flush<N, K1, K2>(vm)) {
+                    return overflow(vm);
+                }
+                vm.mem.swap();
+                return step<NX, NY, D, Depth + 1, 0, 0, 0>(vm);
+            } else if constexpr (op == POP_OP && N >= 1) {
+                return step<NX, NY, D, Depth + 1, N - 1, K1, 0>(vm);
+            } else if constexpr (op == POP_OP) {
+                vm.mem.pop();
+                return step<NX, NY, D, Depth + 1, 0, 0, 0>(vm);
+            } else if constexpr (op == OUTI_OP || op == OUTC_OP) {
+                if (!flush<N - 1, K1, K2>(vm)) {
+                    return overflow(vm);
+                }
+                if constexpr (N >= 1) {
+                    value1 = top;
+                } else {
+                    value1 = vm.mem.pop();
+                }
+                if constexpr (op == OUTI_OP) {
+                    vm.io.write_int(value1);
+                } else {
+                    vm.io.write_char((char)value1);
+                }
+                return step<NX, NY, D, Depth + 1, 0, 0, 0>(vm);
+            } else if constexpr (op == RIGHT_OP || op == LEFT_OP || op == UP_OP || op == DOWN_OP) {
+                constexpr int to = CompiledPlan::arrow_dir(op);
+                return step<next_x(X, to), next_y(Y, to), to, Depth + 1, N, K1, K2>(vm);
+            } else if constexpr (op == NULL_OP) {
+                return step<NX, NY, D, Depth + 1, N, K1, K2>(vm);
+            } else if constexpr (op == BRIDGE_OP) {
+                return step<next_x(NX, D), next_y(NY, D), D, Depth + 1, N, K1, K2>(vm);
+            } else if constexpr (op == STRING_OP) {
+                static constexpr EmbeddedLiteral literal = read_literal(Program, X, Y, D);
+                static constexpr std::array<Value, 80> chars = widen(literal);
+                if (!flush<N, K1, K2>(vm) || !vm.mem.push_chars(chars.data(), literal.length)) {
+                    return overflow(vm);
+                }
+                return step<literal.exit_x, literal.exit_y, D, Depth + 1, 0, 0, 0>(vm);
+            } else if constexpr (op == HORIF_OP || op == VERTIF_OP) {
+                if (!flush<N - 1, K1, K2>(vm)) {
+                    return overflow(vm);
+                }
+                if constexpr (N >= 1) {
+                    value1 = top;
+                } else {
+                    value1 = vm.mem.pop();
+                }
+                if constexpr (op == HORIF_OP) {
+                    return value1 == 0 ? entry<next_x(X, RIGHT), Y, RIGHT>() : entry<next_x(X, LEFT), Y, LEFT>();
+                } else {
+                    return value1 == 0 ? entry<X, next_y(Y, DOWN), DOWN>() : entry<X, next_y(Y, UP), UP>();
+                }
+            } else if constexpr (op == RAND_OP) {
+                static constexpr int to[] = {
+                    entry<X, next_y(Y, UP), UP>(), entry<X, next_y(Y, DOWN), DOWN>(),
+                    entry<next_x(X, LEFT), Y, LEFT>(), entry<next_x(X, RIGHT), Y, RIGHT>()
+                };
+                if (!flush<N, K1, K2>(vm)) {
+                    return overflow(vm);
+                }
+                return to[vm.next_random() >> 62];
+            } else if constexpr (op == GET_OP || op == PUT_OP) {
+                if (!flush<N, K1, K2>(vm)) {
+                    return overflow(vm);
+                }
+                // value1 is y, value2 is x
+                value1 = vm.mem.pop();
+                value2 = vm.mem.pop();
+                if (value2 > PC::maxlimitx || value1 > PC::maxlimity || value2 < 0 || value1 < 0) {
+                    leave_at<NX, NY, D>(vm);
+                    vm.fail(INVALID_ACCESS, std::string(op == GET_OP ? "GET" : "PUT") +
+                            ": Invalid program location access: x=" + std::to_string(value2) +
+                            " y=" + std::to_string(value1));
+                    return STOP;
+                }
+                if constexpr (op == GET_OP) {
+                    vm.mem.push(VM::bytecode_to_char(vm.program[value1][value2]));
+                } else {
+                    Value new_value = vm.mem.pop();
+                    if (new_value > 255) {
+                        leave_at<NX, NY, D>(vm);
+                        vm.fail(INVALID_VALUE, "All program values have to be ascii chars, instead " +
+                                std::to_string(new_value) + "was given.");
+                        return STOP;
+                    }
+                    unsigned int bytecode = VM::char_to_bytecode(new_value);
+                    bool rewrites_code = plan.code[value1][value2] && vm.program[value1][value2] != bytecode;
+                    vm.program[value1][value2] = bytecode;
+                    if (rewrites_code) {
+                        leave_at<NX, NY, D>(vm);
+                        return HAND_OFF;
+                    }
+                }
+                return step<NX, NY, D, Depth + 1, 0, 0, 0>(vm);
+            } else if constexpr (op == INPUTI_OP || op == INPUTC_OP) {
+                if (!vm.io.input_ready()) {
+                    leave_at<X, Y, D>(vm);
+                    vm.status = WAITING_FOR_INPUT;
+                    return STOP;
+                }
+                if constexpr (op == INPUTI_OP) {
+                    vm.io.read_int(value1);
+                } else {
+                    value1 = (Value)vm.io.read_char();
+                }
+                if (!vm.mem.push(value1)) {
+                    return overflow(vm);
+                }
+                return step<NX, NY, D, Depth + 1, 0, 0, 0>(vm);
+            } else if constexpr (op == END_OP) {
+                if (!flush<N, K1, K2>(vm)) {
+                    return overflow(vm);
+                }
+                leave_at<X, Y, D>(vm);
+                vm.mem.on_exit();
+                vm.status = HALTED;
+                return HALT;
+            } else if constexpr (CompiledPlan::is_heap_op(op)) {
+                if (!flush<N, K1, K2>(vm)) {
+                    return overflow(vm);
+                }
+                leave_at<X, Y, D>(vm);
+                if (vm.VM::run(1) != BUDGET_EXHAUSTED) {
+                    return STOP;
+                }
+                return entry<NX, NY, D>();
+            } else {
+                if (!flush<N, K1, K2>(vm)) {
+                    return overflow(vm);
+                }
+                leave_at<X, Y, D>(vm);
+                vm.fail(INVALID_COMMAND, std::string("Invalid command detected << ") + CompiledPlan::to_char(op) +
+                        " >> at " + std::to_string(Y) + "," + std::to_string(X) + ". Exiting.");
+                return STOP;
+            }
+        }
+
+        typedef int (*State)(CompiledVM&);
+
+        template <size_t... I>
+        static constexpr std::array<State, sizeof...(I)> make_states(std::index_sequence<I...>) {
+            return {{&step<plan.x[I], plan.y[I], plan.dir[I], 0, 0, 0, 0>...}};
+        }
+
+        bool handed_off;
+
+    public:
+        CompiledVM() {
+            reset();
+        }
+
+        // the program as compiled, an empty stack and the PC at
+        // the top left corner
+        void reset() {
+            std::copy(&Program.grid[0][0], &Program.grid[0][0] + 25 * 80, &this->program[0][0]);
+            this->pc.limitx = PC::maxlimitx;
+            this->pc.limity = PC::maxlimity;
+            this->static_grid = false;
+            this->restart();
+            handed_off = false;
+        }
+
+        // run to the end, or until & or ~ wait for input
+        RunStatus run() {
+            if (this->status != BUDGET_EXHAUSTED && this->status != WAITING_FOR_INPUT) {
+                return this->status;
+            }
+            this->status = BUDGET_EXHAUSTED;
+
+            static constexpr std::array<State, plan.entries> states =
+                make_states(std::make_index_sequence<plan.entries>());
+
+            int state = plan.id[this->pc.y][this->pc.x][this->curr_dir];
+            if (handed_off || state < 0) {
+                state = HAND_OFF;
+            }
+            while (state >= 0) {
+                state = states[state](*this);
+            }
+
+            if (state == HAND_OFF) {
+                handed_off = true;
+                while (VM::run(LLONG_MAX) == BUDGET_EXHAUSTED) {
+                }
+                return this->status;
+            }
+            this->io.flush();
+            return this->status;
+        }
+
+        // the states the program compiled to
+        static constexpr int entry_states() {
+            return plan.entries;
+        }
+};
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef INCLUDE_ENSEMBLE_HPP
+    #define INCLUDE_ENSEMBLE_HPP
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <stdlib.h>
+#include "vmpool.hpp"
+
+// Ensemble mode: many runs of one program that differ only in the
+// seed of ?, for random walks and Monte Carlo estimates.
+//
+// Instance i is run i of a VMPool, with seed + i and the same input
+// for all. Results come back in instance order, however the instances
+// were spread over the threads.
+struct InstanceResult: public RunResult {
+    unsigned long long seed;
+
+    InstanceResult(): seed(0) {}
+};
+
+// how the outputs of all instances are reported:
+//   concat     every output, in instance order
+//   histogram  every distinct output (trimmed) and how often, most frequent first
+//   mean       count, mean, standard deviation, min and max of the first
+//              number each instance printed
+//   sum        the sum of those numbers
+class EnsembleSummary {
+    private:
+        std::string kind;
+
+        static bool first_number(const std::string& output, double& value) {
+            const char* start = output.c_str();
+            while (*start != '\0') {
+                char* end;
+                value = strtod(start, &end);
+                if (end != start) {
+                    return true;
+                }
+                ++start;
+            }
+            return false;
+        }
+
+        static std::string trimmed(const std::string& output) {
+            size_t from = output.find_first_not_of(" \n");
+            if (from == std::string::npos) {
+                return "";
+            }
+            return output.substr(from, output.find_last_not_of(" \n") - from + 1);
+        }
+
+    public:
+        EnsembleSummary(const std::string& kind): kind(kind) {}
+
+        bool valid() const {
+            return kind == "concat" || kind == "histogram" || kind == "mean" || kind == "sum";
+        }
+
+        void report(const std::vector<InstanceResult>& results, std::ostream& out) const {
+            if (kind == "concat") {
+                for (const InstanceResult& result : results) {
+                    out << result.output;
+                }
+                return;
+            }
+
+            if (kind == "histogram") {
+                std::map<std::string, long long> counts;
+                for (const InstanceResult& result : results) {
+                    ++counts[trimmed(result.output)];
+                }
+                std::vector<std::pair<long long, std::string>> by_count;
+                for (const std::pair<const std::string, long long>& entry : counts) {
+                    by_count.push_back(std::make_pair(-entry.second, entry.first));
+                }
+                std::sort(by_count.begin(), by_count.end());
+                for (const std::pair<long long, std::string>& entry : by_count) {
+                    out << -entry.first << "\t" << entry.second << std::endl;
+                }
+                return;
+            }
+
+            long long n = 0, skipped = 0;
+            double sum = 0, squares = 0;
+            double lowest = 0, highest = 0;
+            for (const InstanceResult& result : results) {
+                double value;
+                if (!first_number(result.output, value)) {
+                    ++skipped;
+                    continue;
+                }
+                lowest = n == 0 ? value : std::min(lowest, value);
+                highest = n == 0 ? value : std::max(highest, value);
+                sum += value;
+                squares += value * value;
+                ++n;
+            }
+
+            if (kind == "sum") {
+                out << sum << std::endl;
+            } else {
+                double mean = n > 0 ? sum / n : 0;
+                double variance = n > 1 ? (squares - n * mean * mean) / (n - 1) : 0;
+                out << "n " << n << std::endl;
+                out << "mean " << mean << std::endl;
+                out << "stddev " << std::sqrt(std::max(variance, 0.0)) << std::endl;
+                out << "min " << lowest << std::endl;
+                out << "max " << highest << std::endl;
+            }
+            if (skipped > 0) {
+                std::cerr << skipped << " instances printed no number" << std::endl;
+            }
+        }
+};
+
+template <typename EmbeddedVM>
+class Ensemble: public VMPool<EmbeddedVM> {
+    public:
+        Ensemble(int threads): VMPool<EmbeddedVM>(threads) {}
+
+        // instance i runs with seed first_seed + i and the same input,
+        // each up to max_instructions
+        std::vector<InstanceResult> run(long long instances, unsigned long long first_seed,
+                                        const std::string& input, long long max_instructions = LLONG_MAX) {
+            std::vector<InstanceResult> results(instances);
+            for (long long i = 0; i < instances; i++) {
+                results[i].seed = first_seed + i;
+            }
+            this->run_all(instances, [&](long long) -> const std::string& { return input; },
+                          first_seed, max_instructions, results);
+            return results;
+        }
+
+        // the command line mode: run the file, print the summary
+        // to stdout and every failed instance to stderr
+        int execute(const char* path, long long instances, unsigned long long first_seed, const char* input_path,
+                    long long max_instructions, const EnsembleSummary& summary) {
+            if (!this->load_file(path)) {
+                return -1;
+            }
+
+            std::string input;
+            if (input_path != NULL && !read_file(input_path, input)) {
+                std::cerr << "Unable to open " << input_path << std::endl;
+                return -1;
+            }
+
+            std::vector<InstanceResult> results = run(instances, first_seed, input, max_instructions);
+            summary.report(results, std::cout);
+
+            long long failed = 0;
+            for (size_t i = 0; i < results.size(); i++) {
+                if (results[i].status != HALTED) {
+                    std::cerr << "instance " << i << " (seed " << results[i].seed << "): " << results[i].error << std::endl;
+                    ++failed;
+                }
+            }
+            if (failed > 0) {
+                std::cerr << failed << " of " << instances << " instances failed" << std::endl;
+                return -1;
+            }
+            return 0;
+        }
+};
+
+#endif
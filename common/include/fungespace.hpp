@@ -0,0 +1,117 @@
+#ifndef INCLUDE_FUNGESPACE_HPP
+    #define INCLUDE_FUNGESPACE_HPP
+#include <vector>
+#include <unordered_map>
+#include <climits>
+#include <algorithm>
+#include "bytecode.hpp"
+
+// Sparse funge-space for the unbounded mode.
+//
+// The grid is cut in 32x32 tiles of bytecode, allocated on the first
+// write of something other than a space and found through a hash map
+// keyed by tile coordinates. Cells of missing tiles read as spaces, so
+// a far away p costs one tile and not the box between it and the
+// program. The tile last looked up is cached; the PC and most g and p
+// stay inside one tile for a while, and then an access is a compare
+// and an index.
+//
+// Coordinates run from 0 to max_coordinate on both axes.
+class FungeSpace {
+    public:
+        static const int max_coordinate = INT_MAX;
+
+    private:
+        static const int shift = 5;
+        static const int tile_size = 1 << shift;
+        static const int mask = tile_size - 1;
+
+        struct Tile {
+            unsigned int cells[tile_size][tile_size];
+        };
+
+        std::vector<Tile> tiles;
+        std::unordered_map<unsigned long long, int> tile_index;
+
+        // the last tile looked up, NULL when it does not exist
+        Tile* cached;
+        int cached_x, cached_y;
+
+        static unsigned long long key(int tile_x, int tile_y) {
+            return ((unsigned long long)(unsigned int)tile_y << 32) | (unsigned int)tile_x;
+        }
+
+        void look_up(int tile_x, int tile_y) {
+            auto found = tile_index.find(key(tile_x, tile_y));
+            cached = found == tile_index.end() ? NULL : &tiles[found->second];
+            cached_x = tile_x;
+            cached_y = tile_y;
+        }
+
+        void forget_cached() {
+            cached = NULL;
+            cached_x = cached_y = -1;
+        }
+
+    public:
+        FungeSpace() {
+            forget_cached();
+        }
+
+        FungeSpace(const FungeSpace& other): tiles(other.tiles), tile_index(other.tile_index) {
+            forget_cached();
+        }
+
+        FungeSpace& operator=(const FungeSpace& other) {
+            tiles = other.tiles;
+            tile_index = other.tile_index;
+            forget_cached();
+            return *this;
+        }
+
+        // every cell a space again
+        void clear() {
+            tiles.clear();
+            tile_index.clear();
+            forget_cached();
+        }
+
+        unsigned int at(int x, int y) {
+            int tile_x = x >> shift, tile_y = y >> shift;
+            if (tile_x != cached_x || tile_y != cached_y) {
+                look_up(tile_x, tile_y);
+            }
+            return cached == NULL ? (unsigned int)NULL_OP : cached->cells[y & mask][x & mask];
+        }
+
+        void set(int x, int y, unsigned int bytecode) {
+            int tile_x = x >> shift, tile_y = y >> shift;
+            if (tile_x != cached_x || tile_y != cached_y) {
+                look_up(tile_x, tile_y);
+            }
+
+            if (cached == NULL) {
+                if (bytecode == (unsigned int)NULL_OP) {
+                    return;
+                }
+                tile_index[key(tile_x, tile_y)] = tiles.size();
+                tiles.emplace_back();
+                std::fill(&tiles.back().cells[0][0], &tiles.back().cells[0][0] + tile_size * tile_size,
+                          (unsigned int)NULL_OP);
+                // the vector may have moved every tile
+                look_up(tile_x, tile_y);
+            }
+            cached->cells[y & mask][x & mask] = bytecode;
+        }
+
+        // tiles allocated so far
+        int tile_count() const {
+            return tiles.size();
+        }
+
+        size_t bytes() const {
+            return tiles.size() * sizeof(Tile) + tile_index.size() * 2 * sizeof(unsigned long long);
+        }
+};
+
+#endif
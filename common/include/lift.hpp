@@ -0,0 +1,450 @@
+#ifndef INCLUDE_LIFT_HPP
+    #define INCLUDE_LIFT_HPP
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+#include <limits>
+#include <utility>
+#include "bytecode.hpp"
+
+// Stack-effect IR for straight-line paths of the grid.
+//
+// Starting from a (cell, direction) the lifter follows the PC
+// through everything that only touches the stack: numbers,
+// arithmetic, : \ $, string literals, . and , plus the arrows,
+// blanks and bridges that just steer the PC. It stops at the
+// first instruction that branches or needs the VM (_ | ? g p & ~
+// @, the heap instructions), which stays on the grid. The path
+// becomes a segment of IR instructions that the optimization
+// passes rewrite:
+//   - constant folding, 25* is a push of 10 and a push followed
+//     by an operator becomes an operator with a constant,
+//   - dead push/pop elimination, :$ and 5$ disappear,
+//   - strength reduction of * / and % by powers of two into shifts,
+//   - one underflow check per segment: the VM runs the segment
+//     only if the stack holds the deepest value it can pop, and
+//     the instructions inside pop without checking.
+enum IR_OPCODE {
+        IR_PUSH = 0,
+        IR_ADD,
+        IR_SUB,
+        IR_MUL,
+        IR_DIV,
+        IR_MOD,
+        IR_GT,
+        IR_NOT,
+        IR_DUP,
+        IR_SWAP,
+        IR_POP,
+        IR_OUTI,
+        IR_OUTC,
+        IR_ADDK,
+        IR_MULK,
+        IR_DIVK,
+        IR_MODK,
+        IR_GTK,
+        IR_SHLK,  // multiply by 1 << k
+        IR_SHRK,  // divide by 1 << k, rounding towards zero
+        IR_MODP2, // remainder of a division by 1 << k
+        IR_EXIT,
+        N_IR_OPS
+};
+
+struct IRInstruction {
+    IR_OPCODE op;
+    long long k;
+};
+
+struct Segment {
+    int state;        // (cell, direction) the segment starts from
+    int start;        // first instruction in the code buffer
+    int need;         // values the segment may pop below its entry depth
+    int cost;         // grid instructions it stands for
+    int exit_x, exit_y;
+    DIRECTION exit_dir;
+};
+
+template <typename Value>
+class Lifter {
+    public:
+        static const int not_lifted = -2;
+        static const int no_segment = -1;
+
+    private:
+        static const int width = 80;
+        static const int height = 25;
+
+        // paths that loop on themselves are cut after this many cells
+        static const int max_cells = 256;
+
+        // cells p keeps rewriting are left on the grid once they
+        // changed this many times, instead of lifting them again
+        static const int volatile_after = 4;
+
+        typedef typename std::make_unsigned<Value>::type Bits;
+
+        std::vector<IRInstruction> code;
+        std::vector<Segment> segments;
+        std::vector<int> segment_of;
+        std::vector<int> users[height][width]; // segments lifted from each cell
+        int writes[height][width];
+        int dead_code;
+
+        static IRInstruction ins(IR_OPCODE op, long long k = 0) {
+            IRInstruction i = {op, k};
+            return i;
+        }
+
+        static unsigned int opcode(unsigned int bytecode) {
+            if (bytecode >= (unsigned int)UNCHECKED_BASE && bytecode < 1000) {
+                return bytecode - UNCHECKED_BASE;
+            }
+            return bytecode;
+        }
+
+        static char to_char(unsigned int bytecode) {
+            bytecode = opcode(bytecode);
+            return bytecode < 1000 ? charset[bytecode] : (char)(bytecode - 1000);
+        }
+
+        static bool is_binary(IR_OPCODE op) {
+            return op >= IR_ADD && op <= IR_GT;
+        }
+
+        static IR_OPCODE with_constant(IR_OPCODE op) {
+            switch (op) {
+            case IR_ADD: return IR_ADDK;
+            case IR_MUL: return IR_MULK;
+            case IR_DIV: return IR_DIVK;
+            case IR_MOD: return IR_MODK;
+            case IR_GT: return IR_GTK;
+            default: return N_IR_OPS;
+            }
+        }
+
+        static int log2_of(long long k) {
+            if (k <= 1 || (k & (k - 1)) != 0) {
+                return -1;
+            }
+            int n = 0;
+            while ((1LL << n) != k) {
+                ++n;
+            }
+            return n;
+        }
+
+        // a op b as the VM computes it on Value, false when
+        // the VM would stop or the result is undefined
+        static bool fold(IR_OPCODE op, Value a, Value b, Value& r) {
+            switch (op) {
+            case IR_ADD: r = (Value)((Bits)a + (Bits)b); return true;
+            case IR_SUB: r = (Value)((Bits)a - (Bits)b); return true;
+            case IR_MUL: r = (Value)((Bits)a * (Bits)b); return true;
+            case IR_DIV: case IR_MOD:
+                if (b == 0 || (b == -1 && a == std::numeric_limits<Value>::min())) {
+                    return false;
+                }
+                r = op == IR_DIV ? a / b : a % b;
+                return true;
+            case IR_GT: r = a > b ? 1 : 0; return true;
+            default: return false;
+            }
+        }
+
+        // one pass of peephole rewrites, true if anything changed
+        static bool rewrite(std::vector<IRInstruction>& ir) {
+            std::vector<IRInstruction> out;
+            bool changed = false;
+
+            for (const IRInstruction& i : ir) {
+                int n = out.size();
+                IRInstruction* last = n > 0 ? &out[n - 1] : NULL;
+                IRInstruction* before = n > 1 ? &out[n - 2] : NULL;
+                Value r;
+
+                // constant folding
+                if (is_binary(i.op) && last && before && last->op == IR_PUSH && before->op == IR_PUSH &&
+                    fold(i.op, (Value)before->k, (Value)last->k, r)) {
+                    out.pop_back();
+                    out.back().k = r;
+                    changed = true;
+                } else if (i.op == IR_SUB && last && last->op == IR_PUSH) {
+                    last->op = IR_ADDK;
+                    last->k = (Value)((Bits)0 - (Bits)(Value)last->k);
+                    changed = true;
+                } else if (is_binary(i.op) && last && last->op == IR_PUSH &&
+                           !((i.op == IR_DIV || i.op == IR_MOD) && (last->k == 0 || last->k == -1))) {
+                    // division by 0 keeps its runtime error, by -1 its overflow
+                    last->op = with_constant(i.op);
+                    changed = true;
+                } else if (i.op == IR_NOT && last && last->op == IR_PUSH) {
+                    last->k = last->k != 0 ? 0 : 1;
+                    changed = true;
+                } else if (i.op == IR_DUP && last && last->op == IR_PUSH) {
+                    out.push_back(*last);
+                    changed = true;
+                } else if (i.op == IR_SWAP && last && before && last->op == IR_PUSH && before->op == IR_PUSH) {
+                    std::swap(last->k, before->k);
+                    changed = true;
+                } else if ((i.op == IR_ADDK || i.op == IR_MULK) && last && last->op == i.op) {
+                    last->k = i.op == IR_ADDK ? (Value)((Bits)(Value)last->k + (Bits)(Value)i.k)
+                                              : (Value)((Bits)(Value)last->k * (Bits)(Value)i.k);
+                    changed = true;
+
+                // dead push/pop elimination
+                } else if (i.op == IR_POP && last && (last->op == IR_PUSH || last->op == IR_DUP)) {
+                    out.pop_back();
+                    changed = true;
+                } else if (i.op == IR_SWAP && last && last->op == IR_SWAP) {
+                    out.pop_back();
+                    changed = true;
+                } else if (i.op == IR_POP && last && (last->op == IR_NOT || (last->op >= IR_ADDK && last->op <= IR_MODP2))) {
+                    // the result is dropped, only the operand pop is left
+                    last->op = IR_POP;
+                    last->k = 0;
+                    changed = true;
+                } else if (i.op == IR_POP && last && is_binary(last->op) && last->op != IR_DIV && last->op != IR_MOD) {
+                    last->op = IR_POP;
+                    last->k = 0;
+                    out.push_back(ins(IR_POP));
+                    changed = true;
+
+                // strength reduction and identities
+                } else if ((i.op == IR_ADDK && (Value)i.k == 0) || ((i.op == IR_MULK || i.op == IR_DIVK) && i.k == 1)) {
+                    changed = true;
+                } else if (i.op == IR_MULK && log2_of(i.k) > 0) {
+                    out.push_back(ins(IR_SHLK, log2_of(i.k)));
+                    changed = true;
+                } else if (i.op == IR_DIVK && log2_of(i.k) > 0) {
+                    out.push_back(ins(IR_SHRK, log2_of(i.k)));
+                    changed = true;
+                } else if (i.op == IR_MODK && log2_of(i.k) > 0) {
+                    out.push_back(ins(IR_MODP2, log2_of(i.k)));
+                    changed = true;
+                } else {
+                    out.push_back(i);
+                }
+            }
+
+            ir.swap(out);
+            return changed;
+        }
+
+        // how deep below its entry depth the segment can pop
+        static int needed_depth(const std::vector<IRInstruction>& ir) {
+            int depth = 0, lowest = 0;
+            for (const IRInstruction& i : ir) {
+                int pops = 0, pushes = 0;
+                switch (i.op) {
+                case IR_PUSH: pushes = 1; break;
+                case IR_DUP: pops = 1; pushes = 2; break;
+                case IR_SWAP: pops = 2; pushes = 2; break;
+                case IR_POP: case IR_OUTI: case IR_OUTC: pops = 1; break;
+                case IR_EXIT: break;
+                default:
+                    pops = is_binary(i.op) ? 2 : 1;
+                    pushes = 1;
+                    break;
+                }
+                depth -= pops;
+                lowest = depth < lowest ? depth : lowest;
+                depth += pushes;
+            }
+            return -lowest;
+        }
+
+        // instructions of the segment, up to and including its exit
+        int needed_code(const Segment& segment) {
+            int end = segment.start;
+            while (code[end].op != IR_EXIT) {
+                ++end;
+            }
+            return end - segment.start + 1;
+        }
+
+        void lift(const unsigned int program[height][width], int x, int y, DIRECTION d) {
+            DIRECTION start_dir = d;
+            std::vector<IRInstruction> ir;
+            std::vector<std::pair<int, int>> cells;
+            PC pc;
+            pc.x = x;
+            pc.y = y;
+            int lifted = 0;
+            int executed = 0;
+            bool stop = false;
+
+            for (int steps = 0; steps < max_cells && !stop; steps++) {
+                if (writes[pc.y][pc.x] >= volatile_after) {
+                    break;
+                }
+
+                unsigned int op = opcode(program[pc.y][pc.x]);
+                int before = ir.size();
+
+                if (op <= NUM9_OP) {
+                    ir.push_back(ins(IR_PUSH, op - NUM0_OP));
+                } else if (op == STRING_OP) {
+                    // only literals that close, and within the cell budget
+                    PC end = pc;
+                    std::vector<IRInstruction> chars;
+                    std::vector<std::pair<int, int>> string_cells;
+                    end.move(d);
+                    while (opcode(program[end.y][end.x]) != STRING_OP && (int)chars.size() < max_cells &&
+                           writes[end.y][end.x] < volatile_after) {
+                        chars.push_back(ins(IR_PUSH, to_char(program[end.y][end.x])));
+                        string_cells.push_back(std::make_pair(end.x, end.y));
+                        end.move(d);
+                    }
+                    if (opcode(program[end.y][end.x]) != STRING_OP) {
+                        break;
+                    }
+                    cells.push_back(std::make_pair(pc.x, pc.y));
+                    cells.insert(cells.end(), string_cells.begin(), string_cells.end());
+                    ir.insert(ir.end(), chars.begin(), chars.end());
+                    pc = end;
+                } else {
+                    switch (op) {
+                    case ADD_OP: ir.push_back(ins(IR_ADD)); break;
+                    case SUB_OP: ir.push_back(ins(IR_SUB)); break;
+                    case MUL_OP: ir.push_back(ins(IR_MUL)); break;
+                    case DIV_OP: ir.push_back(ins(IR_DIV)); break;
+                    case MOD_OP: ir.push_back(ins(IR_MOD)); break;
+                    case GT_OP: ir.push_back(ins(IR_GT)); break;
+                    case NOT_OP: ir.push_back(ins(IR_NOT)); break;
+                    case DUP_OP: ir.push_back(ins(IR_DUP)); break;
+                    case SWAP_OP: ir.push_back(ins(IR_SWAP)); break;
+                    case POP_OP: ir.push_back(ins(IR_POP)); break;
+                    case OUTI_OP: ir.push_back(ins(IR_OUTI)); break;
+                    case OUTC_OP: ir.push_back(ins(IR_OUTC)); break;
+                    case RIGHT_OP: d = RIGHT; break;
+                    case LEFT_OP: d = LEFT; break;
+                    case UP_OP: d = UP; break;
+                    case DOWN_OP: d = DOWN; break;
+                    case NULL_OP: break;
+                    case BRIDGE_OP:
+                        cells.push_back(std::make_pair(pc.x, pc.y));
+                        pc.move(d);
+                        break;
+                    default:
+                        // needs the VM, the segment ends here
+                        stop = true;
+                        break;
+                    }
+                }
+
+                if (stop) {
+                    break;
+                }
+
+                if ((int)ir.size() > before) {
+                    ++lifted;
+                }
+                ++executed;
+                cells.push_back(std::make_pair(pc.x, pc.y));
+                pc.move(d);
+            }
+
+            if (lifted < 2) {
+                return;
+            }
+
+            // the rewrites assume no cell pops an empty stack (two swaps
+            // of a single value are no round trip), keep what the cells need
+            int need = needed_depth(ir);
+            while (rewrite(ir)) {
+            }
+
+            Segment segment;
+            segment.state = (y * width + x) * 4 + start_dir;
+            segment.start = code.size();
+            segment.need = std::max(need, needed_depth(ir));
+            segment.cost = executed;
+            segment.exit_x = pc.x;
+            segment.exit_y = pc.y;
+            segment.exit_dir = d;
+
+            code.insert(code.end(), ir.begin(), ir.end());
+            code.push_back(ins(IR_EXIT));
+            segments.push_back(segment);
+
+            for (std::pair<int, int>& cell : cells) {
+                users[cell.second][cell.first].push_back(segments.size() - 1);
+            }
+        }
+
+    public:
+        Lifter() {
+            reset();
+        }
+
+        // forget every segment
+        void reset() {
+            code.clear();
+            segments.clear();
+            dead_code = 0;
+            segment_of.assign(width * height * 4, (int)not_lifted);
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    users[y][x].clear();
+                    writes[y][x] = 0;
+                }
+            }
+        }
+
+        // p changed the cell, the segments lifted from it are
+        // stale and get lifted again on their next visit
+        void written(int x, int y) {
+            ++writes[y][x];
+
+            for (int index : users[y][x]) {
+                Segment& segment = segments[index];
+                if (segment_of[segment.state] == index) {
+                    segment_of[segment.state] = not_lifted;
+                    dead_code += needed_code(segment);
+                }
+            }
+            users[y][x].clear();
+
+            // drop the buffer once it is mostly stale
+            if (dead_code > 4096 && dead_code * 2 > (int)code.size()) {
+                code.clear();
+                segments.clear();
+                dead_code = 0;
+                segment_of.assign(width * height * 4, (int)not_lifted);
+                for (int j = 0; j < height; j++) {
+                    for (int i = 0; i < width; i++) {
+                        users[j][i].clear();
+                    }
+                }
+            }
+        }
+
+        // p is known to rewrite the cell, counted as written that
+        // many times so that a volatile cell stays on the grid
+        void seed_writes(int x, int y, int times) {
+            writes[y][x] = times;
+        }
+
+        // segment starting at x,y entered moving d, lifted on the
+        // first visit, NULL if there is nothing worth lifting
+        const Segment* lookup(const unsigned int program[height][width], int x, int y, DIRECTION d) {
+            int state = (y * width + x) * 4 + d;
+            int index = segment_of[state];
+
+            if (index == not_lifted) {
+                int before = segments.size();
+                lift(program, x, y, d);
+                index = (int)segments.size() > before ? before : no_segment;
+                segment_of[state] = index;
+            }
+
+            return index == no_segment ? NULL : &segments[index];
+        }
+
+        const IRInstruction* instructions(const Segment* segment) {
+            return &code[segment->start];
+        }
+
+
+};
+#endif
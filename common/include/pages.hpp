@@ -0,0 +1,167 @@
+#ifndef INCLUDE_PAGES_HPP
+    #define INCLUDE_PAGES_HPP
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Memory of the large arrays, the stacks and the befunge93+ heap.
+//
+// An array is an anonymous mapping, so it starts out as zeros and
+// takes memory only as it is touched. Huge pages cut the TLB misses
+// of sweeping the heap and of deep stacks. Asked for explicit huge
+// pages, a mapping first tries MAP_HUGETLB, which needs pages in the
+// kernel's pool (vm.nr_hugepages). If that fails it tries transparent
+// huge pages: a 2 MB aligned mapping advised with MADV_HUGEPAGE. If
+// that fails too it takes normal pages. The kernel backs advised
+// memory with huge pages only as far as it finds them, so how much
+// of it they cover is read back from /proc/self/smaps.
+enum PageKind {
+    SMALL_PAGES = 0,
+    TRANSPARENT_HUGE_PAGES,
+    EXPLICIT_HUGE_PAGES
+};
+
+class PageArray {
+    private:
+        static const size_t huge_page = 2 << 20;
+
+        void* base;
+        size_t bytes;
+        PageKind kind;
+
+        static size_t round_up(size_t n, size_t to) {
+            return (n + to - 1) / to * to;
+        }
+
+        static void* map(size_t n, int flags) {
+            void* p = mmap(NULL, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+            return p == MAP_FAILED ? NULL : p;
+        }
+
+        // 2 MB aligned, the unaligned ends given back
+        static void* map_aligned(size_t n) {
+            char* p = (char*)map(n + huge_page, 0);
+            if (p == NULL) {
+                return NULL;
+            }
+            char* aligned = (char*)round_up((size_t)p, huge_page);
+            if (aligned > p) {
+                munmap(p, aligned - p);
+            }
+            munmap(aligned + n, p + huge_page - aligned);
+            return aligned;
+        }
+
+        // kB of a smaps field over the mappings in [base, base + bytes)
+        long long smaps_kb(const char* field) const {
+            std::ifstream smaps("/proc/self/smaps");
+            std::string line;
+            size_t length = strlen(field);
+            bool inside = false;
+            long long kb = 0;
+            while (std::getline(smaps, line)) {
+                unsigned long long start, end;
+                if (sscanf(line.c_str(), "%llx-%llx ", &start, &end) == 2) {
+                    inside = start < (size_t)base + bytes && end > (size_t)base;
+                } else if (inside && line.compare(0, length, field) == 0) {
+                    kb += atoll(line.c_str() + length);
+                }
+            }
+            return kb;
+        }
+
+    public:
+        // what arrays made from now on ask for
+        static PageKind& requested() {
+            static PageKind kind = SMALL_PAGES;
+            return kind;
+        }
+
+        // false when the name is none of off, transparent and explicit
+        static bool parse(const char* name, PageKind& kind) {
+            std::string s(name);
+            kind = s == "transparent" ? TRANSPARENT_HUGE_PAGES : s == "explicit" ? EXPLICIT_HUGE_PAGES : SMALL_PAGES;
+            return s == "off" || kind != SMALL_PAGES;
+        }
+
+        explicit PageArray(size_t size): base(NULL), bytes(round_up(size, huge_page)), kind(SMALL_PAGES) {
+            PageKind wanted = requested();
+            if (wanted == EXPLICIT_HUGE_PAGES && (base = map(bytes, MAP_HUGETLB | (21 << MAP_HUGE_SHIFT)))) {
+                kind = EXPLICIT_HUGE_PAGES;
+            } else if (wanted != SMALL_PAGES && (base = map_aligned(bytes))) {
+                if (madvise(base, bytes, MADV_HUGEPAGE) == 0) {
+                    kind = TRANSPARENT_HUGE_PAGES;
+                }
+            } else {
+                base = map(bytes, 0);
+            }
+            if (base == NULL) {
+                throw std::bad_alloc();
+            }
+        }
+
+        ~PageArray() {
+            munmap(base, bytes);
+        }
+
+        PageArray(const PageArray&) = delete;
+        PageArray& operator=(const PageArray&) = delete;
+
+        void* data() const {
+            return base;
+        }
+
+        size_t size() const {
+            return bytes;
+        }
+
+        // back the first n bytes now instead of on first touch, the
+        // contents stay as they are
+        void prefault(size_t n) const {
+            size_t page = sysconf(_SC_PAGESIZE);
+            n = std::min(round_up(n, page), bytes);
+#ifdef MADV_POPULATE_WRITE
+            if (madvise(base, n, MADV_POPULATE_WRITE) == 0) {
+                return;
+            }
+#endif
+            volatile char* p = (volatile char*)base;
+            for (size_t i = 0; i < n; i += page) {
+                p[i] = p[i];
+            }
+        }
+
+        PageKind obtained() const {
+            return kind;
+        }
+
+        // bytes of the array now on huge pages
+        long long huge_bytes() const {
+            if (kind == EXPLICIT_HUGE_PAGES) {
+                return bytes;
+            }
+            return kind == SMALL_PAGES ? 0 : smaps_kb("AnonHugePages:") * 1024;
+        }
+
+        // e.g. "2 MB transparent pages, 96 of 384 MB huge"
+        std::string describe() const {
+            std::ostringstream out;
+            if (kind == EXPLICIT_HUGE_PAGES) {
+                out << "2 MB hugetlb pages";
+            } else if (kind == TRANSPARENT_HUGE_PAGES) {
+                out << "2 MB transparent pages, " << (huge_bytes() >> 20) << " of " << (bytes >> 20) << " MB huge";
+            } else {
+                out << sysconf(_SC_PAGESIZE) / 1024 << " KB pages";
+            }
+            return out.str();
+        }
+};
+
+#endif
@@ -0,0 +1,216 @@
+#ifndef INCLUDE_PERFCOUNTERS_HPP
+    #define INCLUDE_PERFCOUNTERS_HPP
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+// Linux perf_event counters for one thread, accumulated over any
+// number of start()/stop() windows.
+//
+// Every event is opened on its own, so a kernel or a virtual machine
+// without some of them (or without a PMU at all) still gets the rest;
+// missing ones are reported as n/a. Counts are scaled when the
+// kernel had to multiplex the counters.
+class PerfCounters {
+    public:
+        enum EVENT {
+            CYCLES = 0,
+            INSTRUCTIONS,
+            BRANCHES,
+            BRANCH_MISSES,
+            L1D_READ_MISSES,
+            LLC_READ_MISSES,
+            TASK_CLOCK,   // ns on the CPU, software, works without a PMU
+            PAGE_FAULTS,
+            N_EVENTS
+        };
+
+    private:
+        int fds[N_EVENTS];
+        unsigned long long totals[N_EVENTS];
+        int windows;
+        std::string unavailable; // why the first missing event is missing
+
+        static const char* name(int event) {
+            static const char* names[] = {"cycles", "instructions", "branches", "branch misses",
+                                          "L1d read misses", "LLC read misses", "task clock ns",
+                                          "page faults"};
+            return names[event];
+        }
+
+        static void describe(int event, perf_event_attr& attr) {
+            static const unsigned long long cache_read_miss =
+                (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+            switch (event) {
+            case CYCLES:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_CPU_CYCLES;
+                break;
+            case INSTRUCTIONS:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+                break;
+            case BRANCHES:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_BRANCH_INSTRUCTIONS;
+                break;
+            case BRANCH_MISSES:
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+                break;
+            case L1D_READ_MISSES:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = PERF_COUNT_HW_CACHE_L1D | cache_read_miss;
+                break;
+            case LLC_READ_MISSES:
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = PERF_COUNT_HW_CACHE_LL | cache_read_miss;
+                break;
+            case TASK_CLOCK:
+                attr.type = PERF_TYPE_SOFTWARE;
+                attr.config = PERF_COUNT_SW_TASK_CLOCK;
+                break;
+            case PAGE_FAULTS:
+                attr.type = PERF_TYPE_SOFTWARE;
+                attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+                break;
+            }
+        }
+
+        void print_count(std::ostream& out, int event) const {
+            out << "  " << std::left << std::setw(18) << name(event) << std::right;
+            if (fds[event] < 0) {
+                out << "n/a";
+            } else {
+                out << totals[event];
+            }
+        }
+
+        // a / b of two events, or of an event and a plain count
+        void print_ratio(std::ostream& out, int event, unsigned long long by, const char* what) const {
+            if (fds[event] >= 0 && by > 0) {
+                out << " (" << std::fixed << std::setprecision(3) << (double)totals[event] / by
+                    << " per " << what << ")" << std::defaultfloat;
+            }
+        }
+
+    public:
+        PerfCounters(): windows(0) {
+            for (int event = 0; event < N_EVENTS; event++) {
+                totals[event] = 0;
+
+                perf_event_attr attr;
+                memset(&attr, 0, sizeof(attr));
+                attr.size = sizeof(attr);
+                describe(event, attr);
+                attr.disabled = 1;
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+                fds[event] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+                if (fds[event] < 0 && unavailable.empty()) {
+                    unavailable = std::string(name(event)) + ": " + strerror(errno);
+                }
+            }
+        }
+
+        ~PerfCounters() {
+            for (int event = 0; event < N_EVENTS; event++) {
+                if (fds[event] >= 0) {
+                    close(fds[event]);
+                }
+            }
+        }
+
+        bool available(int event) const {
+            return fds[event] >= 0;
+        }
+
+        void start() {
+            for (int event = 0; event < N_EVENTS; event++) {
+                if (fds[event] >= 0) {
+                    ioctl(fds[event], PERF_EVENT_IOC_RESET, 0);
+                    ioctl(fds[event], PERF_EVENT_IOC_ENABLE, 0);
+                }
+            }
+        }
+
+        void stop() {
+            for (int event = 0; event < N_EVENTS; event++) {
+                if (fds[event] < 0) {
+                    continue;
+                }
+                ioctl(fds[event], PERF_EVENT_IOC_DISABLE, 0);
+
+                // value, time enabled, time running
+                unsigned long long values[3];
+                if (read(fds[event], values, sizeof(values)) == (ssize_t)sizeof(values)) {
+                    if (values[2] > 0 && values[2] < values[1]) {
+                        values[0] = (unsigned long long)((double)values[0] * values[1] / values[2]);
+                    }
+                    totals[event] += values[0];
+                }
+            }
+            ++windows;
+        }
+
+        unsigned long long total(int event) const {
+            return totals[event];
+        }
+
+        // instructions is the number of Befunge instructions the
+        // window ran, 0 when it was not about running the grid
+        void report(std::ostream& out, const char* title, unsigned long long instructions) const {
+            out << "perf counters, " << title;
+            if (windows != 1) {
+                out << " (" << windows << " windows)";
+            }
+            out << ":" << std::endl;
+
+            if (instructions > 0) {
+                out << "  " << std::left << std::setw(18) << "befunge ins" << std::right << instructions << std::endl;
+            }
+
+            print_count(out, CYCLES);
+            print_ratio(out, CYCLES, instructions, "befunge instruction");
+            out << std::endl;
+
+            print_count(out, INSTRUCTIONS);
+            if (instructions > 0) {
+                print_ratio(out, INSTRUCTIONS, instructions, "befunge instruction");
+            } else if (fds[CYCLES] >= 0) {
+                print_ratio(out, INSTRUCTIONS, totals[CYCLES], "cycle");
+            }
+            out << std::endl;
+
+            print_count(out, BRANCHES);
+            out << std::endl;
+
+            print_count(out, BRANCH_MISSES);
+            print_ratio(out, BRANCH_MISSES, instructions, "dispatch");
+            if (fds[BRANCHES] >= 0) {
+                print_ratio(out, BRANCH_MISSES, totals[BRANCHES], "branch");
+            }
+            out << std::endl;
+
+            for (int event = L1D_READ_MISSES; event < N_EVENTS; event++) {
+                print_count(out, event);
+                print_ratio(out, event, instructions, "befunge instruction");
+                out << std::endl;
+            }
+
+            if (!unavailable.empty()) {
+                out << "  unavailable counters (first: " << unavailable << ")" << std::endl;
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef INCLUDE_PROFILE_HPP
+    #define INCLUDE_PROFILE_HPP
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+// Profile of a run, saved at exit so that the next run of the same
+// program starts warm.
+//
+// While profiling, every dispatch counts a visit of its (cell,
+// direction), every _ and | counts the way it went and every p that
+// changes a cell counts a write; befunge93+ adds what its heap handed
+// out. The file is text, one line per hot state, branch and written
+// cell, keyed by a hash of the decoded grid. A run that finds the
+// profile of its program lifts the hot states before the first
+// instruction and leaves the cells p kept rewriting on the grid;
+// befunge93+ also faults in as much heap as the last run touched.
+// The branch biases are kept for the tiers that will use them.
+class Profile {
+    public:
+        static const int width = 80;
+        static const int height = 25;
+
+        // states kept in the file, the most visited
+        static const size_t max_hot = 1024;
+
+        unsigned long long visits[height * width * 4]; // by (y * width + x) * 4 + direction
+        unsigned long long branches[height][width][2]; // went right or down, went left or up
+        unsigned int writes[height][width];
+
+        long long allocations, collections, peak_cells, heap_cells;
+
+    private:
+        static const int version = 1;
+
+        std::string path;
+        unsigned long long program_id;
+        bool loaded;
+
+        static bool in_grid(int x, int y) {
+            return x >= 0 && x < width && y >= 0 && y < height;
+        }
+
+    public:
+        explicit Profile(const char* path): path(path), program_id(0), loaded(false) {
+            clear();
+        }
+
+        Profile(const Profile&) = delete;
+        Profile& operator=(const Profile&) = delete;
+
+        // FNV-1a of the decoded grid
+        static unsigned long long id_of(const unsigned int grid[height][width]) {
+            unsigned long long hash = 14695981039346656037ULL;
+            const unsigned char* bytes = (const unsigned char*)grid;
+            for (size_t i = 0; i < sizeof(unsigned int) * height * width; i++) {
+                hash = (hash ^ bytes[i]) * 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        void clear() {
+            memset(visits, 0, sizeof(visits));
+            memset(branches, 0, sizeof(branches));
+            memset(writes, 0, sizeof(writes));
+            allocations = collections = peak_cells = heap_cells = 0;
+        }
+
+        // the profile in the file when it is of this program, false
+        // (and cleared) when there is none or it is of another
+        bool load(unsigned long long id) {
+            clear();
+            loaded = false;
+            std::ifstream file(path);
+            std::string line, word;
+            int file_version = 0;
+            unsigned long long file_id = 0;
+            if (!std::getline(file, line) || sscanf(line.c_str(), "befunge profile %d %llx", &file_version,
+                                                    &file_id) != 2 || file_version != version || file_id != id) {
+                return false;
+            }
+
+            while (std::getline(file, line)) {
+                std::istringstream fields(line);
+                fields >> word;
+                int x = 0, y = 0, d = 0;
+                if (word == "hot" && fields >> x >> y >> d && in_grid(x, y) && d >= 0 && d < 4) {
+                    fields >> visits[(y * width + x) * 4 + d];
+                } else if (word == "branch" && fields >> x >> y && in_grid(x, y)) {
+                    fields >> branches[y][x][0] >> branches[y][x][1];
+                } else if (word == "written" && fields >> x >> y && in_grid(x, y)) {
+                    fields >> writes[y][x];
+                } else if (word == "heap") {
+                    fields >> allocations >> collections >> peak_cells >> heap_cells;
+                }
+            }
+            program_id = id;
+            loaded = true;
+            return true;
+        }
+
+        bool was_loaded() const {
+            return loaded;
+        }
+
+        // start counting the run of a program
+        void start(unsigned long long id) {
+            clear();
+            program_id = id;
+        }
+
+        // states by visits, most visited first
+        std::vector<std::pair<unsigned long long, int>> hot(size_t n) const {
+            std::vector<std::pair<unsigned long long, int>> states;
+            for (int state = 0; state < height * width * 4; state++) {
+                if (visits[state] > 0) {
+                    states.push_back(std::make_pair(visits[state], state));
+                }
+            }
+            std::sort(states.rbegin(), states.rend());
+            if (states.size() > n) {
+                states.resize(n);
+            }
+            return states;
+        }
+
+        // false when the file cannot be written
+        bool save() const {
+            std::ofstream file(path);
+            if (!file.is_open()) {
+                std::cerr << "Unable to write profile " << path << std::endl;
+                return false;
+            }
+            file << "befunge profile " << version << " " << std::hex << program_id << std::dec << std::endl;
+            unsigned long long dispatches = 0;
+            for (unsigned long long n : visits) {
+                dispatches += n;
+            }
+            file << "dispatches " << dispatches << std::endl;
+            if (allocations > 0) {
+                file << "heap " << allocations << " " << collections << " " << peak_cells << " " << heap_cells
+                     << std::endl;
+            }
+            for (const std::pair<unsigned long long, int>& state : hot(max_hot)) {
+                int cell = state.second / 4;
+                file << "hot " << cell % width << " " << cell / width << " " << state.second % 4 << " "
+                     << state.first << std::endl;
+            }
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    if (branches[y][x][0] + branches[y][x][1] > 0) {
+                        file << "branch " << x << " " << y << " " << branches[y][x][0] << " " << branches[y][x][1]
+                             << std::endl;
+                    }
+                }
+            }
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    if (writes[y][x] > 0) {
+                        file << "written " << x << " " << y << " " << writes[y][x] << std::endl;
+                    }
+                }
+            }
+            return true;
+        }
+};
+
+#endif
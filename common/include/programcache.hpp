@@ -0,0 +1,115 @@
+#ifndef INCLUDE_PROGRAMCACHE_HPP
+    #define INCLUDE_PROGRAMCACHE_HPP
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include "vmcore.hpp"
+
+// Decoded programs shared by the threads of a process, keyed by the
+// hash of their source (program_id_of).
+//
+// An entry is never written once cached: a VM loads it by copying
+// the grid into its own, where p writes. Entries are handed out as
+// shared pointers, so evicting one does not pull it from under a VM
+// that is loading it. The cache is cut in shards, each with its own
+// lock and least recently used list, so threads looking up different
+// programs rarely meet, and a hit holds a lock for one hash lookup
+// and one list splice. Each shard evicts from its tail to stay under
+// its share of the memory cap.
+struct CachedProgram {
+    unsigned long long id;
+    std::string source;
+    DecodedProgram decoded;
+
+    size_t bytes() const {
+        return sizeof(CachedProgram) - sizeof(DecodedProgram) + source.capacity() + decoded.bytes();
+    }
+};
+
+class ProgramCache {
+    private:
+        static const int shard_count = 16;
+
+        typedef std::shared_ptr<const CachedProgram> Entry;
+
+        struct Shard {
+            std::mutex lock;
+            std::list<Entry> recent; // most recently used first
+            std::unordered_map<unsigned long long, std::list<Entry>::iterator> index;
+            size_t bytes = 0;
+        };
+
+        Shard shards[shard_count];
+        size_t shard_cap;
+        std::atomic<unsigned long long> hit_count, miss_count, eviction_count;
+
+        Shard& shard_of(unsigned long long id) {
+            // FNV mixes the high bits best
+            return shards[(id >> 32) % shard_count];
+        }
+
+    public:
+        explicit ProgramCache(size_t max_bytes):
+            shard_cap(max_bytes / shard_count), hit_count(0), miss_count(0), eviction_count(0) {}
+
+        ProgramCache(const ProgramCache&) = delete;
+        ProgramCache& operator=(const ProgramCache&) = delete;
+
+        // the program with that id, NULL when it is not cached
+        Entry find(unsigned long long id) {
+            Shard& shard = shard_of(id);
+            std::lock_guard<std::mutex> guard(shard.lock);
+            auto found = shard.index.find(id);
+            if (found == shard.index.end()) {
+                ++miss_count;
+                return NULL;
+            }
+            ++hit_count;
+            shard.recent.splice(shard.recent.begin(), shard.recent, found->second);
+            return *found->second;
+        }
+
+        // cache a program, replacing any with the same id. One larger
+        // than a whole shard is not kept
+        void insert(const Entry& program) {
+            size_t bytes = program->bytes();
+            Shard& shard = shard_of(program->id);
+            std::lock_guard<std::mutex> guard(shard.lock);
+
+            auto found = shard.index.find(program->id);
+            if (found != shard.index.end()) {
+                shard.bytes -= (*found->second)->bytes();
+                shard.recent.erase(found->second);
+                shard.index.erase(found);
+            }
+            if (bytes > shard_cap) {
+                return;
+            }
+            while (shard.bytes + bytes > shard_cap) {
+                shard.bytes -= shard.recent.back()->bytes();
+                shard.index.erase(shard.recent.back()->id);
+                shard.recent.pop_back();
+                ++eviction_count;
+            }
+            shard.recent.push_front(program);
+            shard.index[program->id] = shard.recent.begin();
+            shard.bytes += bytes;
+        }
+
+        unsigned long long hits() const {
+            return hit_count;
+        }
+
+        unsigned long long misses() const {
+            return miss_count;
+        }
+
+        unsigned long long evictions() const {
+            return eviction_count;
+        }
+};
+
+#endif
@@ -0,0 +1,140 @@
+#ifndef INCLUDE_PROTOCOL_HPP
+    #define INCLUDE_PROTOCOL_HPP
+#include <string>
+#include <unistd.h>
+#include <errno.h>
+
+// Wire format of the server mode. Client and server share the
+// machine, so integers go over the Unix socket in host order.
+//
+// request:  u64 program id, u32 length + program text (empty to run
+//           the cached program with that id), u32 length + input,
+//           i64 instruction limit, u32 output limit (0 for none)
+// response: i32 RunStatus, u64 program id, i64 instructions,
+//           u32 length + output, u32 length + error message
+//
+// A connection carries any number of requests, one at a time.
+struct Request {
+    unsigned long long program_id;
+    std::string program;
+    std::string input;
+    long long max_instructions;
+    unsigned int max_output;
+
+    Request(): program_id(0), max_instructions(0), max_output(0) {}
+};
+
+struct Response {
+    int status;
+    unsigned long long program_id;
+    long long instructions;
+    std::string output;
+    std::string error;
+
+    Response(): status(0), program_id(0), instructions(0) {}
+};
+
+// FNV-1a of the program text, the id it is cached under
+inline unsigned long long program_id_of(const std::string& program) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (unsigned char c : program) {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+namespace wire {
+    inline bool read_all(int fd, void* data, size_t length) {
+        char* at = (char*)data;
+        while (length > 0) {
+            ssize_t got = ::read(fd, at, length);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                return false;
+            }
+            at += got;
+            length -= got;
+        }
+        return true;
+    }
+
+    inline bool write_all(int fd, const void* data, size_t length) {
+        const char* at = (const char*)data;
+        while (length > 0) {
+            ssize_t put = ::write(fd, at, length);
+            if (put < 0 && errno == EINTR) {
+                continue;
+            }
+            if (put <= 0) {
+                return false;
+            }
+            at += put;
+            length -= put;
+        }
+        return true;
+    }
+
+    template <typename T>
+    void put(std::string& out, T value) {
+        out.append((const char*)&value, sizeof(value));
+    }
+
+    inline void put_string(std::string& out, const std::string& value) {
+        put(out, (unsigned int)value.size());
+        out += value;
+    }
+
+    template <typename T>
+    bool get(int fd, T& value) {
+        return read_all(fd, &value, sizeof(value));
+    }
+
+    // strings longer than this end the connection
+    static const unsigned int max_string = 64 << 20;
+
+    inline bool get_string(int fd, std::string& value) {
+        unsigned int length;
+        if (!get(fd, length) || length > max_string) {
+            return false;
+        }
+        value.resize(length);
+        return length == 0 || read_all(fd, &value[0], length);
+    }
+}
+
+inline bool write_request(int fd, const Request& request) {
+    std::string out;
+    wire::put(out, request.program_id);
+    wire::put_string(out, request.program);
+    wire::put_string(out, request.input);
+    wire::put(out, request.max_instructions);
+    wire::put(out, request.max_output);
+    return wire::write_all(fd, out.data(), out.size());
+}
+
+// false at the end of the connection
+inline bool read_request(int fd, Request& request) {
+    return wire::get(fd, request.program_id) && wire::get_string(fd, request.program) &&
+           wire::get_string(fd, request.input) && wire::get(fd, request.max_instructions) &&
+           wire::get(fd, request.max_output);
+}
+
+inline bool write_response(int fd, const Response& response) {
+    std::string out;
+    wire::put(out, response.status);
+    wire::put(out, response.program_id);
+    wire::put(out, response.instructions);
+    wire::put_string(out, response.output);
+    wire::put_string(out, response.error);
+    return wire::write_all(fd, out.data(), out.size());
+}
+
+inline bool read_response(int fd, Response& response) {
+    return wire::get(fd, response.status) && wire::get(fd, response.program_id) &&
+           wire::get(fd, response.instructions) && wire::get_string(fd, response.output) &&
+           wire::get_string(fd, response.error);
+}
+
+#endif
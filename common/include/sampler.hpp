@@ -0,0 +1,293 @@
+#ifndef INCLUDE_SAMPLER_HPP
+    #define INCLUDE_SAMPLER_HPP
+#include <iostream>
+#include <string>
+#include <string.h>
+#include <errno.h>
+#include <map>
+#include <fstream>
+#include <tuple>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "bytecode.hpp"
+
+// Sampling profiler for the dispatch loop.
+//
+// A CPU-time timer of the VM thread raises SIGPROF; the handler
+// reads the PC, the direction, the opcode under the PC and whether
+// the GC is running, and puts them in a lock-free ring. Nothing is
+// added to the dispatch path. A drain thread empties the ring into
+// counts, which report() writes in the folded stack format of
+// flamegraph.pl, one stack per grid path segment and cell:
+//   seg@9,0>;'-'@11,0 1234
+// The segment is the straight run of cells the PC has been following
+// since the last arrow or branch. While a lifted IR segment runs the
+// PC stays at its first cell, so its samples land there.
+//
+// SIGUSR2 pauses and resumes sampling, to attach to a job that
+// has been running for a while. Pausing also writes the profile so
+// far, reading the grid while the VM may still be changing it.
+struct Sample {
+    unsigned char x, y;
+    unsigned char dir;
+    unsigned char in_gc;
+    unsigned int bytecode;
+};
+
+// one producer (the signal handler) and one consumer, full means
+// the sample is dropped
+class SampleRing {
+    private:
+        static const unsigned int capacity = 1 << 14;
+        Sample samples[capacity];
+        std::atomic<unsigned int> head; // next slot the handler writes
+        std::atomic<unsigned int> tail; // next slot the drain reads
+        std::atomic<unsigned int> dropped;
+
+    public:
+        SampleRing(): head(0), tail(0), dropped(0) {}
+
+        // async signal safe
+        void put(const Sample& sample) {
+            unsigned int at = head.load(std::memory_order_relaxed);
+            if (at - tail.load(std::memory_order_acquire) >= capacity) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            samples[at % capacity] = sample;
+            head.store(at + 1, std::memory_order_release);
+        }
+
+        bool take(Sample& sample) {
+            unsigned int at = tail.load(std::memory_order_relaxed);
+            if (at == head.load(std::memory_order_acquire)) {
+                return false;
+            }
+            sample = samples[at % capacity];
+            tail.store(at + 1, std::memory_order_release);
+            return true;
+        }
+
+        unsigned int lost() {
+            return dropped.load();
+        }
+};
+
+class Sampler {
+    private:
+        static const int width = 80;
+        static const int height = 25;
+
+        // the handler has no other way to find its sampler
+        static inline Sampler* active = NULL;
+
+        const PC* pc;
+        const DIRECTION* dir;
+        const unsigned int (*program)[width];
+        const volatile sig_atomic_t* in_gc; // NULL without a heap
+
+        SampleRing ring;
+        timer_t timer;
+        bool timer_created;
+        long interval_ns;
+        std::atomic<bool> running;
+        std::atomic<bool> toggle;
+        std::atomic<bool> stopping;
+        std::thread drain_thread;
+        std::string snapshot_path;
+
+        // x, y, dir, bytecode, in gc
+        typedef std::tuple<int, int, int, unsigned int, int> Key;
+        std::map<Key, unsigned long long> counts;
+        unsigned long long total;
+
+        static void on_sigprof(int) {
+            Sampler* self = active;
+            if (self == NULL || self->pc == NULL) {
+                return;
+            }
+
+            Sample sample;
+            int x = self->pc->x, y = self->pc->y;
+            sample.x = x;
+            sample.y = y;
+            sample.dir = *self->dir;
+            sample.in_gc = self->in_gc != NULL && *self->in_gc;
+            sample.bytecode = self->program[y][x];
+            self->ring.put(sample);
+        }
+
+        static void on_sigusr2(int) {
+            if (active != NULL) {
+                active->toggle.store(true);
+            }
+        }
+
+        void arm(bool on) {
+            itimerspec spec;
+            spec.it_interval.tv_sec = spec.it_value.tv_sec = on ? interval_ns / 1000000000 : 0;
+            spec.it_interval.tv_nsec = spec.it_value.tv_nsec = on ? interval_ns % 1000000000 : 0;
+            timer_settime(timer, 0, &spec, NULL);
+            running.store(on);
+        }
+
+        void drain() {
+            Sample sample;
+            while (ring.take(sample)) {
+                ++counts[Key(sample.x, sample.y, sample.dir, sample.bytecode, sample.in_gc)];
+                ++total;
+            }
+        }
+
+        void drain_loop() {
+            while (!stopping.load()) {
+                if (toggle.exchange(false)) {
+                    arm(!running.load());
+                    std::cerr << "sampling " << (running.load() ? "resumed" : "paused") << std::endl;
+                    if (!running.load()) {
+                        drain();
+                        std::ofstream snapshot(snapshot_path);
+                        report(snapshot);
+                    }
+                }
+                drain();
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+            drain();
+        }
+
+        static char to_char(unsigned int bytecode) {
+            // the static grid mode marks cells above UNCHECKED_BASE
+            if (bytecode >= (unsigned int)UNCHECKED_BASE && bytecode < 1000) {
+                bytecode -= UNCHECKED_BASE;
+            }
+            return bytecode < 1000 ? charset[bytecode] : (char)(bytecode - 1000);
+        }
+
+        static bool steers(char c) {
+            return c == '>' || c == '<' || c == '^' || c == 'v' || c == '_' || c == '|' || c == '?';
+        }
+
+        // walk back against d to the cell after the last one
+        // that could have turned the PC into this direction
+        void segment_start(int x, int y, DIRECTION d, int& sx, int& sy) const {
+            static const DIRECTION back[] = {DOWN, UP, RIGHT, LEFT};
+
+            PC walk;
+            walk.x = sx = x;
+            walk.y = sy = y;
+            for (int steps = 0; steps < width; steps++) {
+                walk.move(back[d]);
+                if (steers(to_char(program[walk.y][walk.x]))) {
+                    return;
+                }
+                sx = walk.x;
+                sy = walk.y;
+            }
+        }
+
+        static char arrow(int d) {
+            static const char arrows[] = {'^', 'v', '<', '>'};
+            return arrows[d];
+        }
+
+    public:
+        Sampler(): pc(NULL), dir(NULL), program(NULL), in_gc(NULL), timer_created(false), interval_ns(0),
+            running(false), toggle(false), stopping(false), total(0) {}
+
+        ~Sampler() {
+            stop();
+        }
+
+        // what the handler reads, all owned by the VM
+        void attach(const PC* vm_pc, const DIRECTION* vm_dir, const unsigned int grid[height][width],
+                    const volatile sig_atomic_t* gc_flag) {
+            pc = vm_pc;
+            dir = vm_dir;
+            program = grid;
+            in_gc = gc_flag;
+        }
+
+        // sample the calling thread hz times per second of its CPU
+        // time, paused until SIGUSR2 when paused is set. Snapshots
+        // taken on pause go to path
+        bool start(int hz, bool paused, const char* path) {
+            active = this;
+            snapshot_path = path;
+            interval_ns = 1000000000L / (hz > 0 ? hz : 1);
+
+            struct sigaction action;
+            sigemptyset(&action.sa_mask);
+            action.sa_flags = SA_RESTART;
+            action.sa_handler = on_sigprof;
+            sigaction(SIGPROF, &action, NULL);
+            action.sa_handler = on_sigusr2;
+            sigaction(SIGUSR2, &action, NULL);
+
+            sigevent event;
+            memset(&event, 0, sizeof(event));
+            event.sigev_notify = SIGEV_THREAD_ID;
+            event.sigev_signo = SIGPROF;
+            event._sigev_un._tid = syscall(SYS_gettid);
+            if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &timer) != 0) {
+                std::cerr << "Sampling unavailable: " << strerror(errno) << std::endl;
+                return false;
+            }
+            timer_created = true;
+
+            arm(!paused);
+            drain_thread = std::thread([this] { drain_loop(); });
+            return true;
+        }
+
+        void stop() {
+            if (!timer_created) {
+                return;
+            }
+            arm(false);
+            timer_delete(timer);
+            timer_created = false;
+
+            stopping.store(true);
+            drain_thread.join();
+            active = NULL;
+        }
+
+        // folded stacks, call after stop() with the grid as it was left
+        void report(std::ostream& out) const {
+            std::map<std::string, unsigned long long> folded;
+            for (const std::pair<const Key, unsigned long long>& entry : counts) {
+                int x = std::get<0>(entry.first), y = std::get<1>(entry.first);
+                int d = std::get<2>(entry.first);
+                int sx, sy;
+                segment_start(x, y, (DIRECTION)d, sx, sy);
+
+                std::string stack = "seg@" + std::to_string(sx) + "," + std::to_string(sy) + arrow(d) +
+                                    ";'" + to_char(std::get<3>(entry.first)) + "'@" +
+                                    std::to_string(x) + "," + std::to_string(y);
+                if (std::get<4>(entry.first)) {
+                    stack += ";gc";
+                }
+                folded[stack] += entry.second;
+            }
+
+            for (std::pair<const std::string, unsigned long long>& entry : folded) {
+                out << entry.first << " " << entry.second << std::endl;
+            }
+        }
+
+        unsigned long long samples() const {
+            return total;
+        }
+
+        unsigned int dropped() {
+            return ring.lost();
+        }
+};
+
+#endif
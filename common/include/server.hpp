@@ -0,0 +1,299 @@
+#ifndef INCLUDE_SERVER_HPP
+    #define INCLUDE_SERVER_HPP
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <climits>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "protocol.hpp"
+#include "vmcore.hpp"
+#include "programcache.hpp"
+
+// Daemon mode: a Unix socket server in front of a pool of VMs built
+// once at startup, so a request pays for loading its program and
+// running it, not for process startup and the stack and heap
+// allocations.
+//
+// Every worker owns one VM. The accepting thread polls the open
+// connections and queues the ones with a request coming in; a worker
+// answers that one request and hands the connection back, so a client
+// between requests holds no VM. Programs are cached decoded and
+// analyzed, by id, so a program sent again is only copied into the VM,
+// and a client that sent one once can send just the id.
+template <typename EmbeddedVM>
+class Server {
+    private:
+        // run() slice between limit checks
+        static const long long slice = 1 << 16;
+        // a request that started coming in, or its response, must get
+        // through within this many seconds or the connection is closed
+        static const int transfer_timeout = 10;
+        std::string socket_path;
+        std::vector<std::unique_ptr<EmbeddedVM>> pool;
+
+        std::mutex queue_lock;
+        std::condition_variable queue_ready;
+        std::deque<int> connections; // with a request to read
+        std::vector<int> answered;   // for the poller to watch again
+        int wake[2];                 // written to when answered grows
+
+        ProgramCache cache;
+
+        // load the program of the request into vm, from the cache or
+        // decoded there and cached, false with the response filled in
+        // when there is none to run
+        bool load_program(EmbeddedVM& vm, Request& request, Response& response) {
+            if (request.program.empty()) {
+                std::shared_ptr<const CachedProgram> cached = cache.find(request.program_id);
+                if (!cached) {
+                    response.status = INVALID_PROGRAM;
+                    response.error = "Unknown program id";
+                    return false;
+                }
+                vm.load_decoded(cached->decoded);
+                return true;
+            }
+
+            request.program_id = program_id_of(request.program);
+            response.program_id = request.program_id;
+            std::shared_ptr<const CachedProgram> cached = cache.find(request.program_id);
+            // a different source with the same hash replaces the cached one
+            if (cached && cached->source == request.program) {
+                vm.load_decoded(cached->decoded);
+                return true;
+            }
+
+            if (!vm.load_source(request.program)) {
+                response.status = INVALID_PROGRAM;
+                response.error = vm.error_message();
+                return false;
+            }
+            std::shared_ptr<CachedProgram> decoded(new CachedProgram());
+            decoded->id = request.program_id;
+            decoded->source.swap(request.program);
+            vm.save_decoded(decoded->decoded);
+            cache.insert(decoded);
+            return true;
+        }
+
+        void handle(EmbeddedVM& vm, Request& request, Response& response) {
+            response.program_id = request.program_id;
+
+            BufferIO& io = vm.get_io();
+            io.reset();
+            if (!load_program(vm, request, response)) {
+                return;
+            }
+            io.feed(request.input);
+            io.close_input();
+
+            long long limit = request.max_instructions > 0 ? request.max_instructions : LLONG_MAX;
+            RunStatus status;
+            bool output_full = false;
+            do {
+                status = vm.run(std::min(slice, limit - vm.stats().instructions));
+                output_full = request.max_output > 0 && io.output().size() >= request.max_output;
+            } while (status == BUDGET_EXHAUSTED && vm.stats().instructions < limit && !output_full);
+
+            response.status = status;
+            response.instructions = vm.stats().instructions;
+            response.output = io.output();
+            if (request.max_output > 0 && response.output.size() > request.max_output) {
+                response.output.resize(request.max_output);
+            }
+
+            if (is_error(status)) {
+                response.error = vm.error_message();
+            } else if (status == BUDGET_EXHAUSTED) {
+                response.error = output_full ? "Output limit reached" : "Instruction limit reached";
+            }
+        }
+
+        // one request of the connection, false once it is closed
+        bool serve_request(EmbeddedVM& vm, int fd) {
+            Request request;
+            if (!read_request(fd, request)) {
+                return false;
+            }
+            Response response;
+            handle(vm, request, response);
+            return write_response(fd, response);
+        }
+
+        void work(EmbeddedVM& vm) {
+            for (;;) {
+                int fd;
+                {
+                    std::unique_lock<std::mutex> guard(queue_lock);
+                    queue_ready.wait(guard, [this] { return !connections.empty(); });
+                    fd = connections.front();
+                    connections.pop_front();
+                }
+                if (!serve_request(vm, fd)) {
+                    close(fd);
+                    continue;
+                }
+
+                {
+                    std::lock_guard<std::mutex> guard(queue_lock);
+                    answered.push_back(fd);
+                }
+                char byte = 0;
+                if (write(wake[1], &byte, 1) < 0) {
+                    // the pipe is full, the poller is woken up already
+                }
+            }
+        }
+
+        // queue the connections a request is coming in on
+        void dispatch(const std::vector<int>& ready) {
+            if (ready.empty()) {
+                return;
+            }
+            std::lock_guard<std::mutex> guard(queue_lock);
+            connections.insert(connections.end(), ready.begin(), ready.end());
+            queue_ready.notify_all();
+        }
+
+    public:
+        // at most cache_bytes of decoded programs are kept
+        Server(const char* path, int workers, size_t cache_bytes = 64 << 20): socket_path(path), cache(cache_bytes) {
+            for (int i = 0; i < workers; i++) {
+                pool.emplace_back(new EmbeddedVM());
+            }
+        }
+
+        // apply the interpreter options to every VM of the pool
+        template <typename Setup>
+        void configure(Setup setup) {
+            for (std::unique_ptr<EmbeddedVM>& vm : pool) {
+                setup(*vm);
+            }
+        }
+
+        // accept connections forever, -1 if the socket cannot be set up
+        int serve() {
+            signal(SIGPIPE, SIG_IGN);
+
+            int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+            sockaddr_un address;
+            memset(&address, 0, sizeof(address));
+            address.sun_family = AF_UNIX;
+            if (listener < 0 || socket_path.size() >= sizeof(address.sun_path)) {
+                std::cerr << "Unable to create socket " << socket_path << std::endl;
+                return -1;
+            }
+            strcpy(address.sun_path, socket_path.c_str());
+
+            // only a socket, as an earlier server leaves behind, is replaced
+            struct stat existing;
+            if (lstat(socket_path.c_str(), &existing) == 0) {
+                if (!S_ISSOCK(existing.st_mode)) {
+                    std::cerr << "Unable to listen on " << socket_path << ": not a socket" << std::endl;
+                    close(listener);
+                    return -1;
+                }
+                unlink(socket_path.c_str());
+            }
+
+            if (bind(listener, (sockaddr*)&address, sizeof(address)) < 0 || listen(listener, 128) < 0) {
+                std::cerr << "Unable to listen on " << socket_path << ": " << strerror(errno) << std::endl;
+                close(listener);
+                return -1;
+            }
+
+            if (pipe(wake) < 0) {
+                std::cerr << "Unable to create the wake-up pipe: " << strerror(errno) << std::endl;
+                close(listener);
+                return -1;
+            }
+            fcntl(wake[0], F_SETFL, O_NONBLOCK);
+            fcntl(wake[1], F_SETFL, O_NONBLOCK);
+            fcntl(listener, F_SETFL, O_NONBLOCK);
+
+            std::vector<std::thread> workers;
+            for (std::unique_ptr<EmbeddedVM>& vm : pool) {
+                EmbeddedVM* worker_vm = vm.get();
+                workers.emplace_back([this, worker_vm] { work(*worker_vm); });
+            }
+
+            // connections waiting for their next request, after the
+            // listener and the wake-up pipe in watched
+            std::vector<int> idle;
+            std::vector<pollfd> watched;
+            std::vector<int> ready;
+            for (;;) {
+                watched.clear();
+                watched.push_back({listener, POLLIN, 0});
+                watched.push_back({wake[0], POLLIN, 0});
+                for (int fd : idle) {
+                    watched.push_back({fd, POLLIN, 0});
+                }
+                if (poll(watched.data(), watched.size(), -1) < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    std::cerr << "poll: " << strerror(errno) << std::endl;
+                    break;
+                }
+
+                // readable, or closed, which the worker finds out
+                ready.clear();
+                idle.clear();
+                for (size_t i = 2; i < watched.size(); i++) {
+                    (watched[i].revents ? ready : idle).push_back(watched[i].fd);
+                }
+                dispatch(ready);
+
+                if (watched[1].revents) {
+                    char drained[64];
+                    while (read(wake[0], drained, sizeof(drained)) > 0) {
+                    }
+                    std::lock_guard<std::mutex> guard(queue_lock);
+                    idle.insert(idle.end(), answered.begin(), answered.end());
+                    answered.clear();
+                }
+
+                if (watched[0].revents) {
+                    int fd = accept(listener, NULL, NULL);
+                    if (fd < 0) {
+                        if (errno == EINTR || errno == ECONNABORTED || errno == EAGAIN) {
+                            continue;
+                        }
+                        std::cerr << "accept: " << strerror(errno) << std::endl;
+                        break;
+                    }
+                    // a client that stops halfway through a request, or
+                    // does not read its response, gives the worker back
+                    timeval timeout = {transfer_timeout, 0};
+                    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                    idle.push_back(fd);
+                }
+            }
+
+            close(listener);
+            // workers never return, the process ends with them
+            for (std::thread& worker : workers) {
+                worker.detach();
+            }
+            return -1;
+        }
+};
+
+#endif
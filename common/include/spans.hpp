@@ -0,0 +1,116 @@
+#ifndef INCLUDE_SPANS_HPP
+    #define INCLUDE_SPANS_HPP
+#include <vector>
+#include "bytecode.hpp"
+
+// String literals, precomputed per (opening quote, direction).
+//
+// The first time the PC enters a " the cells up to the closing "
+// are decoded once into a contiguous run of values, wrapping around
+// the grid like the PC does. Every later visit pushes the run in
+// one go and continues after the closing ". A literal never runs
+// forever: without another " on its row or column it closes on
+// its own opening quote after a full lap.
+struct Span {
+    int state;        // (opening quote, direction) the span starts from
+    int start;        // first value in the character buffer
+    int length;
+    int exit_x, exit_y;
+};
+
+template <typename Value>
+class StringSpans {
+    private:
+        static const int width = 80;
+        static const int height = 25;
+        static const int not_decoded = -1;
+
+        std::vector<Value> chars;
+        std::vector<Span> spans;
+        std::vector<int> span_of;
+        std::vector<int> users[height][width]; // spans decoded from each cell
+        int dead_chars;
+
+    public:
+        // forget every span
+        void reset() {
+            chars.clear();
+            spans.clear();
+            dead_chars = 0;
+            span_of.assign(width * height * 4, (int)not_decoded);
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    users[y][x].clear();
+                }
+            }
+        }
+
+    private:
+        int decode(const unsigned int program[height][width], int x, int y, DIRECTION d,
+                   char (*to_char)(unsigned int)) {
+            Span span;
+            span.state = (y * width + x) * 4 + d;
+            span.start = chars.size();
+
+            PC pc;
+            pc.x = x;
+            pc.y = y;
+            int index = spans.size();
+            users[y][x].push_back(index);
+
+            pc.move(d);
+            while (program[pc.y][pc.x] != STRING_OP) {
+                chars.push_back(to_char(program[pc.y][pc.x]));
+                users[pc.y][pc.x].push_back(index);
+                pc.move(d);
+            }
+            users[pc.y][pc.x].push_back(index);
+            pc.move(d);
+
+            span.length = chars.size() - span.start;
+            span.exit_x = pc.x;
+            span.exit_y = pc.y;
+            spans.push_back(span);
+            return index;
+        }
+
+    public:
+        StringSpans() {
+            reset();
+        }
+
+        // literal opened by the " at x,y entered moving d,
+        // decoded with to_char on the first visit
+        const Span* lookup(const unsigned int program[height][width], int x, int y, DIRECTION d,
+                           char (*to_char)(unsigned int)) {
+            int& index = span_of[(y * width + x) * 4 + d];
+            if (index == not_decoded) {
+                index = decode(program, x, y, d, to_char);
+            }
+            return &spans[index];
+        }
+
+        const Value* characters(const Span* span) {
+            return chars.data() + span->start;
+        }
+
+        // p changed the cell, the spans running through it
+        // are decoded again on their next visit
+        void written(int x, int y) {
+            for (int index : users[y][x]) {
+                Span& span = spans[index];
+                if (span_of[span.state] == index) {
+                    span_of[span.state] = not_decoded;
+                    dead_chars += span.length + 1;
+                }
+            }
+            users[y][x].clear();
+
+            // drop the buffer once it is mostly stale
+            if (dead_chars > 4096 && dead_chars * 2 > (int)chars.size()) {
+                reset();
+            }
+        }
+};
+
+#endif
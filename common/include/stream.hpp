@@ -0,0 +1,81 @@
+#ifndef INCLUDE_STREAM_HPP
+    #define INCLUDE_STREAM_HPP
+#include <iostream>
+#include <string>
+#include <vector>
+#include <climits>
+#include "vmpool.hpp"
+
+// Streaming mode: one program applied to every record of a stream,
+// for filters over inputs too large for a process per record.
+//
+// Records are read in batches and a batch runs on a VMPool, a record
+// being the whole input of its run and seeding ? with seed + its
+// index. When the batch is done the outputs are written in record
+// order, each followed by the delimiter, so the output does not depend
+// on the number of threads.
+template <typename EmbeddedVM>
+class Stream: public VMPool<EmbeddedVM> {
+    private:
+        // records read per worker before the batch runs
+        static const size_t batch_per_worker = 1 << 10;
+
+    public:
+        Stream(int threads): VMPool<EmbeddedVM>(threads) {}
+
+        // every record of in, split at the delimiter, through the
+        // program; record i seeds ? with first_seed + i. Failed
+        // records go to stderr, the number of them is returned
+        long long run(std::istream& in, std::ostream& out, char delimiter, unsigned long long first_seed,
+                      long long max_instructions = LLONG_MAX) {
+            size_t batch = batch_per_worker * this->pool.size();
+            std::vector<std::string> records(batch);
+            std::vector<RunResult> results(batch);
+            unsigned long long index = 0;
+            long long failed = 0;
+
+            for (;;) {
+                size_t count = 0;
+                while (count < batch && std::getline(in, records[count], delimiter)) {
+                    ++count;
+                }
+                if (count == 0) {
+                    break;
+                }
+                records.resize(count);
+                this->run_all(count, [&](long long i) -> const std::string& { return records[i]; },
+                              first_seed + index, max_instructions, results);
+
+                for (size_t i = 0; i < count; i++) {
+                    out << results[i].output << delimiter;
+                    if (results[i].status != HALTED) {
+                        std::cerr << "record " << index + i << ": " << results[i].error << std::endl;
+                        ++failed;
+                    }
+                }
+                index += count;
+                records.resize(batch);
+            }
+            out.flush();
+            return failed;
+        }
+
+        // the command line mode: the file over stdin to stdout
+        int execute(const char* path, char delimiter, unsigned long long first_seed, long long max_instructions) {
+            if (!this->load_file(path)) {
+                return -1;
+            }
+
+            // outputs go out a batch at a time, not flushed one by one
+            std::ios::sync_with_stdio(false);
+            std::cout.unsetf(std::ios::unitbuf);
+            long long failed = run(std::cin, std::cout, delimiter, first_seed, max_instructions);
+            if (failed > 0) {
+                std::cerr << failed << " records failed" << std::endl;
+                return -1;
+            }
+            return 0;
+        }
+};
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef INCLUDE_TRACER_HPP
+    #define INCLUDE_TRACER_HPP
+#include <iostream>
+#include <atomic>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Execution trace, to find out afterwards what a run was doing.
+//
+// Opt in, off by default. Every grid instruction about to run is a
+// fixed size record in a ring in memory: its cell, the direction, the
+// bytecode and the top of the stack. befunge93+ adds its allocations
+// and collections. Recording stores one record and bumps a counter,
+// the oldest records are overwritten. The ring is written to its file
+// at exit, on SIGINT and SIGTERM, on a crash (SIGSEGV, SIGBUS, SIGFPE,
+// SIGILL, SIGABRT, after which the signal goes on to kill the process)
+// and on SIGUSR1, which keeps the run going. The file is opened up
+// front and written with write(2) only, so that the handlers stay
+// async signal safe. tracedump/ decodes it.
+//
+// The file is a TraceHeader and then the records kept, oldest first.
+enum TraceEvent : unsigned char {
+    TRACE_INSTRUCTION = 0,
+    TRACE_ALLOCATE,  // value the new pointer, op its cells
+    TRACE_GC_START,  // value the cells in use
+    TRACE_GC_END,    // value the cells in use
+    TRACE_END        // value the RunStatus the run ended with
+};
+
+struct TraceRecord {
+    signed long long value; // top of the stack for instructions
+    unsigned int x, y;
+    unsigned int op;        // the bytecode under the PC
+    unsigned char event;
+    unsigned char dir;
+    unsigned char unused[2];
+};
+
+struct TraceHeader {
+    char magic[8];
+    unsigned int version;
+    unsigned int record_size;
+    unsigned long long recorded; // records ever made, the file has the last ones
+    unsigned long long capacity;
+};
+
+static const char trace_magic[8] = {'B', '9', '3', 'T', 'R', 'A', 'C', 'E'};
+static const unsigned int trace_version = 1;
+
+class Tracer {
+    private:
+        // the handlers have no other way to find the tracer
+        static inline Tracer* active = NULL;
+
+        TraceRecord* ring;
+        unsigned long long mask;
+        std::atomic<unsigned long long> recorded;
+        int fd;
+
+        static void write_all(int fd, const void* data, size_t bytes) {
+            const char* p = (const char*)data;
+            while (bytes > 0) {
+                ssize_t n = write(fd, p, bytes);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    return;
+                }
+                p += n;
+                bytes -= n;
+            }
+        }
+
+        static void at_exit() {
+            if (active != NULL) {
+                active->flush();
+            }
+        }
+
+        static void on_fatal(int signal) {
+            at_exit();
+            // SA_RESETHAND restored the default action
+            raise(signal);
+        }
+
+        static void on_stop(int signal) {
+            at_exit();
+            ::signal(signal, SIG_DFL);
+            raise(signal);
+        }
+
+        static void on_sigusr1(int) {
+            at_exit();
+        }
+
+        TraceRecord& next() {
+            unsigned long long at = recorded.load(std::memory_order_relaxed);
+            recorded.store(at + 1, std::memory_order_relaxed);
+            return ring[at & mask];
+        }
+
+    public:
+        Tracer(): ring(NULL), mask(0), recorded(0), fd(-1) {}
+
+        ~Tracer() {
+            flush();
+            if (active == this) {
+                active = NULL;
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+            delete[] ring;
+        }
+
+        Tracer(const Tracer&) = delete;
+        Tracer& operator=(const Tracer&) = delete;
+
+        // keep the last records (rounded up to a power of 2) and write
+        // them to path, false when it cannot be created
+        bool start(const char* path, unsigned long long records) {
+            fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                std::cerr << "Unable to open " << path << ": " << strerror(errno) << std::endl;
+                return false;
+            }
+            unsigned long long capacity = 1;
+            while (capacity < records) {
+                capacity <<= 1;
+            }
+            ring = new TraceRecord[capacity]();
+            mask = capacity - 1;
+
+            if (active == NULL) {
+                atexit(at_exit);
+            }
+            active = this;
+
+            struct sigaction action;
+            sigemptyset(&action.sa_mask);
+            action.sa_flags = SA_RESETHAND;
+            action.sa_handler = on_fatal;
+            for (int signal : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT}) {
+                sigaction(signal, &action, NULL);
+            }
+            action.sa_flags = 0;
+            action.sa_handler = on_stop;
+            sigaction(SIGINT, &action, NULL);
+            sigaction(SIGTERM, &action, NULL);
+            action.sa_flags = SA_RESTART;
+            action.sa_handler = on_sigusr1;
+            sigaction(SIGUSR1, &action, NULL);
+            return true;
+        }
+
+        void record(unsigned int x, unsigned int y, int dir, unsigned int op, signed long long top) {
+            next() = TraceRecord{top, x, y, op, TRACE_INSTRUCTION, (unsigned char)dir, {0, 0}};
+        }
+
+        void event(TraceEvent event, unsigned int x, unsigned int y, signed long long value, unsigned int op = 0) {
+            TraceRecord& r = next();
+            r.value = value;
+            r.x = x;
+            r.y = y;
+            r.op = op;
+            r.event = event;
+            r.dir = 0;
+        }
+
+        // the file rewritten with the ring as it is, async signal safe
+        void flush() {
+            if (fd < 0) {
+                return;
+            }
+            TraceHeader header;
+            memcpy(header.magic, trace_magic, sizeof(header.magic));
+            header.version = trace_version;
+            header.record_size = sizeof(TraceRecord);
+            header.recorded = recorded.load(std::memory_order_relaxed);
+            header.capacity = mask + 1;
+
+            unsigned long long kept = header.recorded < header.capacity ? header.recorded : header.capacity;
+            unsigned long long first = (header.recorded - kept) & mask;
+            unsigned long long to_end = kept < header.capacity - first ? kept : header.capacity - first;
+
+            lseek(fd, 0, SEEK_SET);
+            write_all(fd, &header, sizeof(header));
+            write_all(fd, ring + first, to_end * sizeof(TraceRecord));
+            // kept never shrinks, nothing is left over from an earlier flush
+            write_all(fd, ring, (kept - to_end) * sizeof(TraceRecord));
+        }
+};
+
+#endif
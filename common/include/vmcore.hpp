@@ -0,0 +1,1626 @@
+#ifndef INCLUDE_VMCORE_HPP
+    #define INCLUDE_VMCORE_HPP
+#include <iostream>
+#include <stdlib.h>
+#include <time.h>
+#include <fstream>
+#include <string>
+#include <algorithm>
+#include <sstream>
+#include <vector>
+#include <climits>
+#include "bytecode.hpp"
+#include "analysis.hpp"
+#include "lift.hpp"
+#include "spans.hpp"
+#include "fungespace.hpp"
+#include "pages.hpp"
+#include "perfcounters.hpp"
+#include "sampler.hpp"
+#include "tracer.hpp"
+#include "profile.hpp"
+
+// Interpreter core shared by befunge93 and befunge93+.
+//
+// BasicVM is parameterized at compile time by
+//   Value  - the stack cell type (32 or 64 bit)
+//   Memory - the memory manager every stack access goes through.
+//            NoHeap forwards straight to the stack, befunge93+
+//            plugs its garbage collector in here and gets the
+//            c, h and t instructions enabled
+//   IO     - where &, ~, . and , read from and write to
+//
+// A memory manager provides
+//   static const bool has_heap;
+//   Memory(Stack<Value>& stack);
+//   bool push(Value); Value pop(); bool dup(); void swap();
+//   Value pop_unchecked(); (the stack is known not to be empty)
+//   bool push_chars(const Value*, int); (a string literal, in order)
+//   void on_exit(); void clear(); (empty the stack for a new program)
+//   const volatile sig_atomic_t* gc_flag(); (set while collecting, or NULL)
+// where the pushes return false on stack overflow, and, when
+// has_heap is set,
+//   static bool is_pointer(Value); bool is_cons(Value); (a live cell)
+//   Value allocate(Value head, Value tail, int x, int y); (0 when full)
+//   Value get_head(Value); Value get_tail(Value);
+//   Value allocate_vector(Value length, int x, int y); (0 when full)
+//   bool is_vector(Value); Value vector_length(Value);
+//   Value vector_element(Value, Value i);
+//   void set_vector_element(Value, Value i, Value);
+//   void set_tracer(Tracer*); (allocations and collections go there)
+//
+// An IO policy provides read_int, read_char (-1 at end of input),
+// write_int, write_char, flush and input_ready, false when & or ~
+// would have to wait for input that is not there yet.
+
+
+// BEFUNGE STACK
+template <typename Value>
+class Stack {
+    private:
+        int curr_index;
+        int capacity;
+        PageArray memory;
+        Value* contents;
+    public:
+        Stack(int capacity): curr_index(-1), capacity(capacity), memory(capacity * sizeof(Value)),
+            contents((Value*)memory.data()) {}
+
+        const PageArray& pages() {
+            return memory;
+        }
+
+        int max_capacity() {
+            return capacity;
+        }
+
+        int size() {
+            return curr_index + 1;
+        }
+
+        // bottom to top, size() elements
+        Value* data() {
+            return contents;
+        }
+
+        // false on overflow, the stack is left as it was
+        bool push(Value item) {
+            if (curr_index + 1 >= capacity) {
+                return false;
+            }
+
+            contents[++curr_index] = item;
+            return true;
+        }
+
+        // n values in order, the last one ends on top. On overflow
+        // the stack is filled up, as pushing them one by one would
+        bool push_span(const Value* items, int n) {
+            if (curr_index + n >= capacity) {
+                int fit = capacity - 1 - curr_index;
+                std::copy(items, items + fit, contents + curr_index + 1);
+                curr_index += fit;
+                return false;
+            }
+
+            std::copy(items, items + n, contents + curr_index + 1);
+            curr_index += n;
+            return true;
+        }
+
+        Value pop() {
+            // pop 0, when empty
+            if (curr_index < 0) {
+                return 0;
+            }
+
+            return contents[curr_index--];
+        }
+
+        // for callers that know the stack is not empty
+        Value pop_unchecked() {
+            return contents[curr_index--];
+        }
+
+        // i-th element from the top, 0 when the stack is not that deep
+        Value peek(int i = 0) {
+            return curr_index - i >= 0 ? contents[curr_index - i] : 0;
+        }
+
+        bool empty() {
+            return curr_index == -1;
+        }
+
+        void clear() {
+            curr_index = -1;
+        }
+
+        bool dup() {
+            // if has more than self explanatory,
+            // else add a zero to the top
+            if (curr_index + 1 >= capacity) {
+                return false;
+            }
+
+            curr_index++;
+            if (curr_index > 0) {
+                contents[curr_index] = contents[curr_index - 1];
+            } else {
+                contents[curr_index] = 0;
+            }
+            return true;
+        }
+
+        void exchange_two_first() {
+            if (curr_index > 0) {
+                // has two elements, swap them
+                Value top = contents[curr_index];
+                contents[curr_index] = contents[curr_index - 1];
+                contents[curr_index - 1] = top;
+            } else if (curr_index == 0) {
+                // has one element, add a zero in front
+                curr_index++;
+                contents[curr_index] = 0;
+            } else {
+                // has no elements, add two zeros
+                curr_index += 2;
+                contents[0] = 0;
+                contents[1] = 0;
+            }
+        }
+
+        // helper
+        void print_stack() {
+            std::cout << "STACK BOTTOM" << std::endl;
+            for (int i = 0; i <= curr_index; i++) {
+                std::cout << contents[i] << std::endl;
+            }
+            std::cout << "STACK TOP" << std::endl;
+        }
+};
+
+// memory manager without a heap
+template <typename Value>
+class NoHeap {
+    private:
+        Stack<Value>& stack;
+
+    public:
+        static const bool has_heap = false;
+
+        NoHeap(Stack<Value>& stack): stack(stack) {}
+
+        bool push(Value val) {
+            return stack.push(val);
+        }
+
+        Value pop() {
+            return stack.pop();
+        }
+
+        Value pop_unchecked() {
+            return stack.pop_unchecked();
+        }
+
+        bool push_chars(const Value* chars, int n) {
+            return stack.push_span(chars, n);
+        }
+
+        bool dup() {
+            return stack.dup();
+        }
+
+        void swap() {
+            stack.exchange_two_first();
+        }
+
+        void on_exit() {}
+
+        void clear() {
+            stack.clear();
+        }
+
+        const volatile sig_atomic_t* gc_flag() {
+            return NULL;
+        }
+};
+
+
+// standard input and output
+class StdIO {
+    public:
+        template <typename Value>
+        void read_int(Value& value) {
+            std::cin >> value;
+        }
+
+        // -1 at end of input
+        int read_char() {
+            char c;
+            return std::cin.get(c) ? c : -1;
+        }
+
+        template <typename Value>
+        void write_int(Value value) {
+            std::cout << value;
+        }
+
+        void write_char(char c) {
+            std::cout << c;
+        }
+
+        // reads block until there is input
+        bool input_ready() {
+            return true;
+        }
+
+        void flush() {
+            std::cout.flush();
+        }
+};
+
+// why run() returned, everything from DIVISION_BY_ZERO on is
+// an error and the VM stays stopped
+enum RunStatus {
+        HALTED = 0,         // reached @
+        BUDGET_EXHAUSTED,   // ran its instructions, run again to continue
+        WAITING_FOR_INPUT,  // & or ~ found no input, the PC stays on it
+        DIVISION_BY_ZERO,
+        STACK_OVERFLOW,
+        OUT_OF_MEMORY,
+        INVALID_COMMAND,
+        INVALID_ACCESS,     // g or p outside the grid
+        INVALID_VALUE,      // p of a value that is not a char
+        INVALID_DEREFERENCE,
+        INVALID_PROGRAM     // the source does not fit the grid or cannot be read
+};
+
+// what the caller gets back besides the output
+struct RunStats {
+    long long instructions; // executed by run(), segments count in full
+    int stack_size;
+};
+
+inline bool is_error(RunStatus status) {
+    return status >= DIVISION_BY_ZERO;
+}
+
+
+// A program as loading left it: the grid with the static grid
+// marks of the analysis, its extent and whether p may write to code.
+// Never written once saved, so any number of threads can load from
+// one at the same time.
+struct DecodedProgram {
+    unsigned int program[25][80];
+    FungeSpace space;
+    bool unbounded;
+    int limitx, limity;
+    bool static_grid;
+
+    // memory held
+    size_t bytes() const {
+        return sizeof(DecodedProgram) + space.bytes();
+    }
+};
+
+template <typename Value, typename Memory, typename IO>
+class BasicVM {
+    protected:
+        unsigned int program[25][80];
+        PC pc;
+        DIRECTION curr_dir;
+        Stack<Value> stack;
+        Memory mem;
+        IO io;
+
+        ProgramAnalysis analysis;
+        bool fast_mode;
+        bool static_grid; // p never writes to code for this program
+        bool grid_written; // p changed a cell since the grid was loaded
+
+        Lifter<Value> lifter;
+        bool lifting;
+
+        StringSpans<Value> strings;
+
+        // unbounded mode: the grid lives in space instead of program
+        // and the PC wraps at the larger of 80x25 and the program
+        FungeSpace space;
+        bool unbounded;
+
+        RunStatus status;
+        std::string error;
+        long long executed; // instructions run() went through
+        PerfCounters* perf; // NULL unless counting around execute()
+        Tracer* tracer;     // NULL unless tracing
+        Profile* profile;   // NULL unless profiling
+        unsigned long long random_state; // xorshift64*, never 0
+
+        unsigned long long next_random() {
+            random_state ^= random_state >> 12;
+            random_state ^= random_state << 25;
+            random_state ^= random_state >> 27;
+            return random_state * 2685821657736338717ULL;
+        }
+
+        static bool in_space(Value x, Value y) {
+            return x >= 0 && y >= 0 && x <= FungeSpace::max_coordinate && y <= FungeSpace::max_coordinate;
+        }
+
+        RunStatus fail(RunStatus reason, const std::string& message) {
+            status = reason;
+            error = message;
+            return status;
+        }
+
+        // transform bytecode to character
+        // everything not in valid commands has
+        // an offset of 1000
+        static char bytecode_to_char(unsigned int a) {
+            if (a < (unsigned int)UNCHECKED_BASE) {
+                 return charset[a];
+            } else if (a < 1000) {
+                 return charset[a - UNCHECKED_BASE];
+            } else {
+                return (char)(a - 1000);
+            }
+        }
+
+
+        // convert a char to bytecode to match with labels
+        // if char is not a valid command, add 1000 to separate
+        // to completely separate it from command bytecode
+        // and allow 1-1 conversion
+        static constexpr unsigned int char_to_bytecode(const char a) {
+            return bytecode_table.codes[Memory::has_heap][(unsigned char)a];
+        }
+
+        static bool has_unchecked_variant(unsigned int op) {
+            switch (op) {
+            case ADD_OP: case SUB_OP: case MUL_OP: case DIV_OP: case MOD_OP:
+            case NOT_OP: case GT_OP: case HORIF_OP: case VERTIF_OP:
+            case POP_OP: case OUTI_OP: case OUTC_OP:
+                return true;
+            default:
+                return false;
+            }
+        }
+
+        // static grid fast mode: if the analysis shows that p
+        // never rewrites code, nothing executed ever changes and
+        // the cells that provably never pop an empty stack can
+        // run without the underflow check
+        void enter_static_grid_mode() {
+            analysis.run(program, Memory::has_heap);
+            static_grid = analysis.is_static_grid();
+
+            if (!static_grid) {
+                return;
+            }
+
+            for (int y = 0; y <= pc.maxlimity; y++) {
+                for (int x = 0; x <= pc.maxlimitx; x++) {
+                    if (analysis.pops_safe(x, y) && has_unchecked_variant(program[y][x])) {
+                        program[y][x] += UNCHECKED_BASE;
+                    }
+                }
+            }
+        }
+
+        // lines of any length and any number of them, into space
+        void parse_unbounded(std::istream& source) {
+            space.clear();
+            int x = 0, y = 0, width = 0;
+            char c;
+            while (source.get(c)) {
+                if (c == '\n') {
+                    ++y;
+                    x = 0;
+                    continue;
+                }
+                space.set(x, y, char_to_bytecode(c));
+                width = std::max(width, ++x);
+            }
+            int height = y + (x > 0 ? 1 : 0);
+
+            pc.limitx = std::max(width - 1, (int)pc.maxlimitx);
+            pc.limity = std::max(height - 1, (int)pc.maxlimity);
+        }
+
+        // the grid from a stream of lines, false when it does not fit
+        bool parse(std::istream& source) {
+            if (unbounded) {
+                parse_unbounded(source);
+                return true;
+            }
+            pc.limitx = pc.maxlimitx;
+            pc.limity = pc.maxlimity;
+
+            int limitx = pc.maxlimitx;
+            int limity = pc.maxlimity;
+
+            int i,j;
+            i = j = 0;
+
+            char c;
+
+            // initialize program with null
+            // instructions
+            for (int i = 0; i <= pc.maxlimity; i++) {
+                for (int j = 0; j <= pc.maxlimitx; j++) {
+                    program[i][j] = char_to_bytecode(' ');
+                }
+            }
+
+
+            // read program and convert to bytecode
+            while (source.get(c) && i >= 0 && j >= 0 && j <= limitx && i <= limity)
+            {
+                if (c != '\n') {
+                    program[i][j] = char_to_bytecode(c);
+
+                    if (bytecode_to_char(char_to_bytecode(c)) != c) {
+                        std::cerr << "WRONG CONVERSION:" << c << std::endl;
+                    }
+                    ++j;
+                } else {
+                    ++i;
+                    j = 0;
+                }
+            }
+
+            if (!(i >= 0 && j >= 0 && j <= pc.maxlimitx && i <= pc.maxlimity)) {
+                error = "i,j= " + std::to_string(i) + "," + std::to_string(j) +
+                        "\nNot a valid befunge93 file";
+                return false;
+            }
+            return true;
+        }
+
+        // start over on a freshly loaded grid
+        void prepare() {
+            static_grid = false;
+            // the profile is keyed by the grid as decoded, before the
+            // static grid mode marks its cells
+            unsigned long long id = profile && !unbounded ? Profile::id_of(program) : 0;
+            if (fast_mode && !unbounded) {
+                enter_static_grid_mode();
+            }
+            restart();
+            if (profile && !unbounded) {
+                warm_start(id);
+            }
+        }
+
+        // the profile of the last run of program id, if there is
+        // one, applied before the first instruction, then cleared to
+        // count this run
+        void warm_start(unsigned long long id) {
+            if (profile->load(id)) {
+                if (lifting) {
+                    for (int y = 0; y < Profile::height; y++) {
+                        for (int x = 0; x < Profile::width; x++) {
+                            lifter.seed_writes(x, y, profile->writes[y][x]);
+                        }
+                    }
+                    for (const std::pair<unsigned long long, int>& state : profile->hot(Profile::max_hot)) {
+                        int cell = state.second / 4;
+                        lifter.lookup(program, cell % Profile::width, cell / Profile::width,
+                                      (DIRECTION)(state.second % 4));
+                    }
+                }
+                if constexpr (Memory::has_heap) {
+                    mem.prefault(profile->heap_cells);
+                }
+            }
+            profile->start(id);
+        }
+
+        // back to the top left corner with an empty stack
+        void restart() {
+            rewind();
+            lifter.reset();
+            strings.reset();
+            grid_written = false;
+        }
+
+        // restart() for a grid that has not changed, what was lifted
+        // and decoded from it still holds
+        void rewind() {
+            pc.x = pc.y = 0;
+            curr_dir = RIGHT;
+            mem.clear();
+            status = BUDGET_EXHAUSTED;
+            error.clear();
+            executed = 0;
+        }
+
+    public:
+        typedef Value value_type;
+        typedef Memory memory_type;
+
+        BasicVM(int stack_capacity): pc(PC()), curr_dir(RIGHT), stack(stack_capacity), mem(stack),
+            fast_mode(true), static_grid(false), grid_written(false), lifting(false), unbounded(false),
+            status(BUDGET_EXHAUSTED), executed(0), perf(NULL), tracer(NULL), profile(NULL) {
+            set_seed(time(NULL));
+        }
+
+        // ? draws from a generator of its own per VM, the same
+        // seed gives the same directions
+        void set_seed(unsigned long long seed) {
+            // splitmix64 so that nearby seeds give unrelated streams
+            seed += 0x9E3779B97F4A7C15ULL;
+            seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBULL;
+            random_state = (seed ^ (seed >> 31)) | 1;
+        }
+
+        // on by default, turn off to always run the grid as loaded
+        void set_fast_mode(bool enabled) {
+            fast_mode = enabled;
+        }
+
+        // run straight-line paths as optimized IR segments
+        void set_lifting(bool enabled) {
+            lifting = enabled;
+        }
+
+        // programs of any size on a sparse grid, g and p anywhere
+        // from 0 to FungeSpace::max_coordinate. Static grid mode and
+        // lifting do not apply
+        void set_unbounded(bool enabled) {
+            unbounded = enabled;
+        }
+
+        const PageArray& stack_pages() {
+            return stack.pages();
+        }
+
+        // the page size the stack got, and how much of it is on huge pages
+        void report_pages(std::ostream& out) {
+            out << "stack: " << stack_pages().describe() << std::endl;
+        }
+
+        // load and analyze a program without running it, NULL (and
+        // the reason in error_message()) when it cannot be loaded
+        const ProgramAnalysis* analyze(const char* input_file_path) {
+            if (!load_program(input_file_path)) {
+                return NULL;
+            }
+            analysis.run(program, Memory::has_heap);
+            return &analysis;
+        }
+
+        void print_program() {
+            for (int i = 0; i <= pc.limity; i++) {
+                for (int j = 0; j <= pc.limitx; j++) {
+                   std::cout << bytecode_to_char(program[i][j]);
+                }
+
+                std::cout << std::endl;
+            }
+        }
+
+        // read program from file, convert to bytecode
+        // and return program limits to avoid. False (and the
+        // reason in error_message()) when it cannot be read or
+        // does not fit the grid
+        bool load_program(const char* input_file_path) {
+            std::ifstream program_file(input_file_path);
+
+            if (!program_file.is_open()) {
+                fail(INVALID_PROGRAM, "Unable to open file");
+                return false;
+            }
+            if (!parse(program_file)) {
+                status = INVALID_PROGRAM;
+                return false;
+            }
+            return true;
+        }
+
+        // load a program for run(), the PC at the top left corner,
+        // false as load_program()
+        bool load(const char* input_file_path) {
+            if (!load_program(input_file_path)) {
+                return false;
+            }
+            prepare();
+            return true;
+        }
+
+        // load a program held in memory, false (and the reason in
+        // error_message()) when it does not fit the grid
+        bool load_source(const char* source, size_t length) {
+            std::istringstream source_stream(std::string(source, length));
+            if (!parse(source_stream)) {
+                status = INVALID_PROGRAM;
+                return false;
+            }
+            prepare();
+            return true;
+        }
+
+        bool load_source(const std::string& source) {
+            return load_source(source.data(), source.size());
+        }
+
+        // the loaded program as decoded and analyzed, to load into
+        // other VMs; call it before running, p changes the grid
+        void save_decoded(DecodedProgram& decoded) const {
+            if (unbounded) {
+                decoded.space = space;
+            } else {
+                std::copy(&program[0][0], &program[0][0] + 25 * 80, &decoded.program[0][0]);
+            }
+            decoded.unbounded = unbounded;
+            decoded.limitx = pc.limitx;
+            decoded.limity = pc.limity;
+            decoded.static_grid = static_grid;
+        }
+
+        // a program saved with save_decoded(), only the grid is copied
+        void load_decoded(const DecodedProgram& decoded) {
+            if (decoded.unbounded) {
+                space = decoded.space;
+            } else {
+                std::copy(&decoded.program[0][0], &decoded.program[0][0] + 25 * 80, &program[0][0]);
+            }
+            unbounded = decoded.unbounded;
+            pc.limitx = decoded.limitx;
+            pc.limity = decoded.limity;
+            static_grid = decoded.static_grid;
+            restart();
+        }
+
+        // the program of the last load_decoded() from the start again,
+        // for the next record of a stream. The grid is copied only if
+        // p changed it, otherwise lifted segments and spans are kept
+        void reload(const DecodedProgram& decoded) {
+            if (grid_written) {
+                load_decoded(decoded);
+            } else {
+                rewind();
+            }
+        }
+
+        // run about that many grid instructions and stop at
+        // the next instruction boundary. A lifted segment counts as
+        // the instructions it stands for and runs to its end
+        RunStatus run(long long instructions) {
+            if (status != BUDGET_EXHAUSTED && status != WAITING_FOR_INPUT) {
+                return status;
+            }
+
+            long long budget = instructions;
+            if (tracer) {
+                if (unbounded) {
+                    interpret<false, true, true, true>(budget);
+                } else {
+                    interpret<false, true, false, true>(budget);
+                }
+                trace_end();
+            } else if (unbounded) {
+                interpret<false, true, true>(budget);
+            } else if (profile) {
+                if (lifting) {
+                    interpret<true, true, false, false, true>(budget);
+                } else {
+                    interpret<false, true, false, false, true>(budget);
+                }
+            } else if (lifting) {
+                interpret<true, true>(budget);
+            } else {
+                interpret<false, true>(budget);
+            }
+            // a segment takes the budget below zero by the cells it ran
+            // past it, and the instruction that found it spent by one more
+            executed += instructions - budget - (budget < 0 ? 1 : 0);
+            io.flush();
+            return status;
+        }
+
+        RunStatus last_status() {
+            return status;
+        }
+
+        // the I/O policy, to feed input and collect output
+        IO& get_io() {
+            return io;
+        }
+
+        RunStats stats() {
+            RunStats result;
+            result.instructions = executed;
+            result.stack_size = stack.size();
+            return result;
+        }
+
+        // what the program left on the stack, bottom first
+        std::vector<Value> stack_contents() {
+            return std::vector<Value>(stack.data(), stack.data() + stack.size());
+        }
+
+        // what went wrong, when last_status() is an error
+        const std::string& error_message() {
+            return error;
+        }
+
+        // count hardware events around execute(), which then runs the
+        // budgeted loop to know how many instructions it went through
+        void set_perf_counters(PerfCounters* counters) {
+            perf = counters;
+        }
+
+        // record every instruction in the tracer's ring, and the
+        // allocations and collections of a heap. Tracing runs
+        // without lifting, so that each grid instruction is seen
+        void set_tracer(Tracer* t) {
+            tracer = t;
+            if constexpr (Memory::has_heap) {
+                mem.set_tracer(t);
+            }
+        }
+
+        // count the dispatches, branches and writes of every program
+        // loaded from now on, and warm start one from the profile
+        // when the profile is of that program
+        void set_profile(Profile* p) {
+            profile = p;
+        }
+
+        // the profile of the run so far to its file
+        bool save_profile() {
+            if constexpr (Memory::has_heap) {
+                auto gc = mem.stats();
+                profile->allocations = gc.allocations;
+                profile->collections = gc.collections;
+                profile->peak_cells = gc.peak_cells;
+                profile->heap_cells = mem.heap_high_water();
+            }
+            return profile->save();
+        }
+
+        // let the sampler read the PC, the grid and the GC state
+        void attach_sampler(Sampler& sampler) {
+            sampler.attach(&pc, &curr_dir, program, mem.gc_flag());
+        }
+
+        // run to the end. An error is printed and its status returned,
+        // so that the caller still reports on the run before exiting
+        RunStatus execute(const char* input_file_path) {
+            if (!load(input_file_path)) {
+                std::cerr << error << std::endl;
+                return status;
+            }
+
+            if (perf) {
+                perf->start();
+                while (run(LLONG_MAX) == BUDGET_EXHAUSTED) {
+                }
+                perf->stop();
+            } else {
+                long long unlimited = 0;
+                if (tracer) {
+                    if (unbounded) {
+                        interpret<false, false, true, true>(unlimited);
+                    } else {
+                        interpret<false, false, false, true>(unlimited);
+                    }
+                    trace_end();
+                } else if (unbounded) {
+                    interpret<false, false, true>(unlimited);
+                } else if (profile) {
+                    if (lifting) {
+                        interpret<true, false, false, false, true>(unlimited);
+                    } else {
+                        interpret<false, false, false, false, true>(unlimited);
+                    }
+                } else if (lifting) {
+                    interpret<true, false>(unlimited);
+                } else {
+                    interpret<false, false>(unlimited);
+                }
+                io.flush();
+            }
+            if (profile) {
+                save_profile();
+            }
+
+            if (is_error(status)) {
+                // invalid commands were always reported on stdout
+                (status == INVALID_COMMAND ? std::cout : std::cerr) << error << std::endl;
+            }
+            return status;
+        }
+
+    protected:
+        // the last record of a run that has ended
+        void trace_end() {
+            if (status != BUDGET_EXHAUSTED && status != WAITING_FOR_INPUT) {
+                tracer->event(TRACE_END, pc.x, pc.y, status);
+            }
+        }
+
+        // the dispatch loop, with Lifted every dispatch first
+        // looks for an IR segment starting at the PC, with
+        // Budgeted it returns once the budget is spent, with Sparse
+        // the grid is space, with Traced every instruction goes
+        // to the tracer, with Profiled the profile counts dispatches,
+        // branches and writes
+        template <bool Lifted, bool Budgeted, bool Sparse = false, bool Traced = false, bool Profiled = false>
+        RunStatus interpret(long long& budget) {
+            #define FETCH(x, y) (Sparse ? space.at(x, y) : program[y][x])
+            #define NEXT_INS {\
+                if constexpr (Budgeted) {\
+                    if (--budget < 0) {\
+                        return status = BUDGET_EXHAUSTED;\
+                    }\
+                }\
+                if constexpr (Profiled) {\
+                    ++profile->visits[(pc.y * Profile::width + pc.x) * 4 + curr_dir];\
+                }\
+                if constexpr (Lifted) {\
+                    segment = lifter.lookup(program, pc.x, pc.y, curr_dir);\
+                    if (segment != NULL && stack.size() >= segment->need) {\
+                        if constexpr (Budgeted) {\
+                            budget -= segment->cost - 1;\
+                        }\
+                        ip = lifter.instructions(segment);\
+                        goto *(ir_table[ip->op]);\
+                    }\
+                }\
+                jump_location = FETCH(pc.x, pc.y);\
+                if constexpr (Traced) {\
+                    tracer->record(pc.x, pc.y, curr_dir, jump_location, stack.peek());\
+                }\
+                goto *(command_table[jump_location < N_DISPATCH? jump_location: N_COMMANDS]);}
+            #define NEXT_IR {\
+                ++ip;\
+                goto *(ir_table[ip->op]);}
+
+            // indirect threading
+            static const void* command_table[] = {
+                        &&NUM0_LAB,
+                        &&NUM1_LAB,
+                        &&NUM2_LAB,
+                        &&NUM3_LAB,
+                        &&NUM4_LAB,
+                        &&NUM5_LAB,
+                        &&NUM6_LAB,
+                        &&NUM7_LAB,
+                        &&NUM8_LAB,
+                        &&NUM9_LAB,
+                        &&ADD_LAB,
+                        &&SUB_LAB,
+                        &&MUL_LAB,
+                        &&DIV_LAB,
+                        &&MOD_LAB,
+                        &&NOT_LAB,
+                        &&GT_LAB,
+                        &&RIGHT_LAB,
+                        &&LEFT_LAB,
+                        &&UP_LAB,
+                        &&DOWN_LAB,
+                        &&RAND_LAB,
+                        &&HORIF_LAB,
+                        &&VERTIF_LAB,
+                        &&STRING_LAB,
+                        &&DUP_LAB,
+                        &&SWAP_LAB,
+                        &&POP_LAB,
+                        &&OUTI_LAB,
+                        &&OUTC_LAB,
+                        &&BRIDGE_LAB,
+                        &&GET_LAB,
+                        &&PUT_LAB,
+                        &&INPUTI_LAB,
+                        &&INPUTC_LAB,
+                        &&END_LAB,
+                        &&CONS_LAB,
+                        &&HEAD_LAB,
+                        &&TAIL_LAB,
+                        &&VECTOR_LAB,
+                        &&VGET_LAB,
+                        &&VSET_LAB,
+                        &&VLEN_LAB,
+                        &&NULL_LAB,
+                        &&INVALID_LAB,
+                        // UNCHECKED_BASE
+                        &&NUM0_LAB,
+                        &&NUM1_LAB,
+                        &&NUM2_LAB,
+                        &&NUM3_LAB,
+                        &&NUM4_LAB,
+                        &&NUM5_LAB,
+                        &&NUM6_LAB,
+                        &&NUM7_LAB,
+                        &&NUM8_LAB,
+                        &&NUM9_LAB,
+                        &&ADD_NC_LAB,
+                        &&SUB_NC_LAB,
+                        &&MUL_NC_LAB,
+                        &&DIV_NC_LAB,
+                        &&MOD_NC_LAB,
+                        &&NOT_NC_LAB,
+                        &&GT_NC_LAB,
+                        &&RIGHT_LAB,
+                        &&LEFT_LAB,
+                        &&UP_LAB,
+                        &&DOWN_LAB,
+                        &&RAND_LAB,
+                        &&HORIF_NC_LAB,
+                        &&VERTIF_NC_LAB,
+                        &&STRING_LAB,
+                        &&DUP_LAB,
+                        &&SWAP_LAB,
+                        &&POP_NC_LAB,
+                        &&OUTI_NC_LAB,
+                        &&OUTC_NC_LAB,
+                        &&BRIDGE_LAB,
+                        &&GET_LAB,
+                        &&PUT_LAB,
+                        &&INPUTI_LAB,
+                        &&INPUTC_LAB,
+                        &&END_LAB,
+                        &&CONS_LAB,
+                        &&HEAD_LAB,
+                        &&TAIL_LAB,
+                        &&VECTOR_LAB,
+                        &&VGET_LAB,
+                        &&VSET_LAB,
+                        &&VLEN_LAB,
+                        &&NULL_LAB
+            };
+
+            // IR handlers, in IR_OPCODE order
+            static const void* ir_table[] = {
+                        &&IR_PUSH_LAB,
+                        &&IR_ADD_LAB,
+                        &&IR_SUB_LAB,
+                        &&IR_MUL_LAB,
+                        &&IR_DIV_LAB,
+                        &&IR_MOD_LAB,
+                        &&IR_GT_LAB,
+                        &&IR_NOT_LAB,
+                        &&IR_DUP_LAB,
+                        &&IR_SWAP_LAB,
+                        &&IR_POP_LAB,
+                        &&IR_OUTI_LAB,
+                        &&IR_OUTC_LAB,
+                        &&IR_ADDK_LAB,
+                        &&IR_MULK_LAB,
+                        &&IR_DIVK_LAB,
+                        &&IR_MODK_LAB,
+                        &&IR_GTK_LAB,
+                        &&IR_SHLK_LAB,
+                        &&IR_SHRK_LAB,
+                        &&IR_MODP2_LAB,
+                        &&IR_EXIT_LAB
+            };
+
+            typedef typename std::make_unsigned<Value>::type Bits;
+            static const int sign_shift = sizeof(Value) * 8 - 1;
+
+            Value value1,value2;
+            int jump_location;
+            const Segment* segment = NULL;
+            const IRInstruction* ip = NULL;
+            const Span* span = NULL;
+
+            NEXT_INS;
+
+            ADD_LAB:
+                pc.move(curr_dir);
+                value2 = mem.pop();
+                value1 = mem.pop();
+                mem.push(value1 + value2);
+                NEXT_INS;
+            SUB_LAB:
+                pc.move(curr_dir);
+                value2 = mem.pop();
+                value1 = mem.pop();
+                mem.push(value1 - value2);
+                NEXT_INS;
+            MUL_LAB:
+                pc.move(curr_dir);
+                value2 = mem.pop();
+                value1 = mem.pop();
+                mem.push(value1 * value2);
+                NEXT_INS;
+            DIV_LAB:
+                pc.move(curr_dir);
+                value2 = mem.pop();
+                value1 = mem.pop();
+                if (value2 == 0) {
+                    return fail(DIVISION_BY_ZERO, "Error: Division by zero");
+                }
+                mem.push(value1 / value2);
+                NEXT_INS;
+            MOD_LAB:
+                pc.move(curr_dir);
+                value2 = mem.pop();
+                value1 = mem.pop();
+                if (value2 == 0) {
+                    return fail(DIVISION_BY_ZERO, "Error: Division by zero");
+                }
+                mem.push(value1 % value2);
+                NEXT_INS;
+            NOT_LAB:
+                pc.move(curr_dir);
+                value1 = mem.pop();
+                mem.push(value1 != 0? 0: 1);
+                NEXT_INS;
+            GT_LAB:
+                pc.move(curr_dir);
+                value2 = mem.pop();
+                value1 = mem.pop();
+                mem.push(value1 > value2? 1 : 0 );
+                NEXT_INS;
+            RIGHT_LAB:
+                curr_dir = RIGHT;
+                pc.move(curr_dir);
+                NEXT_INS;
+            LEFT_LAB:
+                curr_dir = LEFT;
+                pc.move(curr_dir);
+                NEXT_INS;
+            UP_LAB:
+                curr_dir = UP;
+                pc.move(curr_dir);
+                NEXT_INS;
+            DOWN_LAB:
+                curr_dir = DOWN;
+                pc.move(curr_dir);
+                NEXT_INS;
+            RAND_LAB:
+                curr_dir = (DIRECTION)(next_random() >> 62);
+                pc.move(curr_dir);
+                NEXT_INS;
+            HORIF_LAB:
+                value1 = mem.pop();
+                if constexpr (Profiled) {
+                    ++profile->branches[pc.y][pc.x][value1 != 0];
+                }
+                curr_dir = value1 == 0 ? RIGHT: LEFT;
+                pc.move(curr_dir);
+                NEXT_INS;
+            VERTIF_LAB:
+                value1 = mem.pop();
+                if constexpr (Profiled) {
+                    ++profile->branches[pc.y][pc.x][value1 != 0];
+                }
+                curr_dir = value1 == 0 ? DOWN: UP;
+                pc.move(curr_dir);
+                NEXT_INS;
+            STRING_LAB:
+                if constexpr (Sparse) {
+                    // no spans, the literal is read cell by cell
+                    pc.move(curr_dir);
+                    while ((jump_location = space.at(pc.x, pc.y)) != STRING_OP) {
+                        if (!mem.push(bytecode_to_char(jump_location))) {
+                            goto OVERFLOW_LAB;
+                        }
+                        pc.move(curr_dir);
+                    }
+                    pc.move(curr_dir);
+                    NEXT_INS;
+                }
+                // the whole literal in one go, continue
+                // after the closing "
+                span = strings.lookup(program, pc.x, pc.y, curr_dir, bytecode_to_char);
+                if (!mem.push_chars(strings.characters(span), span->length)) {
+                    goto OVERFLOW_LAB;
+                }
+                pc.x = span->exit_x;
+                pc.y = span->exit_y;
+                NEXT_INS;
+            DUP_LAB:
+                pc.move(curr_dir);
+                if (!mem.dup()) {
+                    goto OVERFLOW_LAB;
+                }
+                NEXT_INS;
+
+            SWAP_LAB:
+                pc.move(curr_dir);
+                mem.swap();
+                NEXT_INS;
+
+            POP_LAB:
+                pc.move(curr_dir);
+                mem.pop();
+                NEXT_INS;
+
+            OUTI_LAB:
+                pc.move(curr_dir);
+                value1 = mem.pop();
+                io.write_int(value1);
+                NEXT_INS;
+
+            OUTC_LAB:
+                pc.move(curr_dir);
+                value1 = mem.pop();
+                io.write_char((char)value1);
+                NEXT_INS;
+
+            BRIDGE_LAB:
+                pc.move(curr_dir);
+                pc.move(curr_dir);
+                NEXT_INS;
+
+            GET_LAB:
+                if constexpr (Sparse) {
+                    pc.move(curr_dir);
+                    value1 = mem.pop();
+                    value2 = mem.pop();
+                    if (!in_space(value2, value1)) {
+                        return fail(INVALID_ACCESS, "GET: Invalid program location access: x=" +
+                                    std::to_string(value2) + " y=" + std::to_string(value1));
+                    }
+                    mem.push(bytecode_to_char(space.at(value2, value1)));
+                    NEXT_INS;
+                }
+                pc.move(curr_dir);
+                // value1 is y, value2 is x
+                value1 = mem.pop();
+                value2 = mem.pop();
+
+                if (value2 <= pc.limitx && value1 <= pc.limity &&
+                    value2 >= 0 && value1 >= 0) {
+                        mem.push(bytecode_to_char(program[value1][value2]));
+                } else {
+                    return fail(INVALID_ACCESS, "GET: Invalid program location access: x=" +
+                                std::to_string(value2) + " y=" + std::to_string(value1));
+                }
+
+                NEXT_INS;
+            PUT_LAB:
+                if constexpr (Sparse) {
+                    pc.move(curr_dir);
+                    value1 = mem.pop();
+                    value2 = mem.pop();
+                    if (!in_space(value2, value1)) {
+                        return fail(INVALID_ACCESS, "PUT: Invalid program location access: x=" +
+                                    std::to_string(value2) + " y=" + std::to_string(value1));
+                    }
+                    Value stored = mem.pop();
+                    if (stored > 255) {
+                        return fail(INVALID_VALUE, "All program values have to be ascii chars, instead " +
+                                    std::to_string(stored) + "was given.");
+                    }
+                    space.set(value2, value1, char_to_bytecode(stored));
+                    grid_written = true;
+                    NEXT_INS;
+                }
+                pc.move(curr_dir);
+                // value1 is y, value2 is x
+                value1 = mem.pop();
+                value2 = mem.pop();
+
+                if (value2 <= pc.limitx && value1 <= pc.limity &&
+                    value2 >= 0 && value1 >= 0) {
+                        Value new_value = mem.pop();
+
+                        if (new_value > 255) {
+                            return fail(INVALID_VALUE, "All program values have to be ascii chars, instead " +
+                                        std::to_string(new_value) + "was given.");
+                        }
+                        jump_location = char_to_bytecode(new_value);
+
+                        if (program[value1][value2] != (unsigned int)jump_location) {
+                            grid_written = true;
+                            if constexpr (Profiled) {
+                                ++profile->writes[value1][value2];
+                            }
+                            // spans and segments decoded from the old cell are stale
+                            if (!static_grid) {
+                                strings.written(value2, value1);
+                                if constexpr (Lifted) {
+                                    lifter.written(value2, value1);
+                                }
+                            }
+                        }
+                        program[value1][value2] = jump_location;
+                } else {
+                    return fail(INVALID_ACCESS, "PUT: Invalid program location access: x=" +
+                                std::to_string(value2) + " y=" + std::to_string(value1));
+                }
+                NEXT_INS;
+
+            INPUTI_LAB:
+                if (!io.input_ready()) {
+                    return status = WAITING_FOR_INPUT;
+                }
+                pc.move(curr_dir);
+                io.read_int(value1);
+                if (!mem.push(value1)) {
+                    goto OVERFLOW_LAB;
+                }
+                NEXT_INS;
+            INPUTC_LAB:
+                if (!io.input_ready()) {
+                    return status = WAITING_FOR_INPUT;
+                }
+                pc.move(curr_dir);
+                if (!mem.push((Value)io.read_char())) {
+                    goto OVERFLOW_LAB;
+                }
+                NEXT_INS;
+            NUM0_LAB:
+                pc.move(curr_dir);
+                if (!mem.push(0)) {
+                    goto OVERFLOW_LAB;
+                }
+                NEXT_INS;
+            NUM1_LAB:
+                pc.move(curr_dir);
+                if (!mem.push(1)) {
+                    goto OVERFLOW_LAB;
+                }
+                NEXT_INS;
+            NUM2_LAB:
+                pc.move(curr_dir);
+                if (!mem.push(2)) {
+                    goto OVERFLOW_LAB;
+                }
+                NEXT_INS;
+            NUM3_LAB:
+                pc.move(curr_dir);
+                if (!mem.push(3)) {
+                    goto OVERFLOW_LAB;
+                }
+                NEXT_INS;
+            NUM4_LAB:
+                pc.move(curr_dir);
+                if (!mem.push(4)) {
+                    goto OVERFLOW_LAB;
+                }
+                NEXT_INS;
+            NUM5_LAB:
+                pc.move(curr_dir);
+                if (!mem.push(5)) {
+                    goto OVERFLOW_LAB;
+                }
+                NEXT_INS;
+            NUM6_LAB:
+                pc.move(curr_dir);
+                if (!mem.push(6)) {
+                    goto OVERFLOW_LAB;
+                }
+                NEXT_INS;
+            NUM7_LAB:
+                pc.move(curr_dir);
+                if (!mem.push(7)) {
+                    goto OVERFLOW_LAB;
+                }
+                NEXT_INS;
+            NUM8_LAB:
+                pc.move(curr_dir);
+                if (!mem.push(8)) {
+                    goto OVERFLOW_LAB;
+                }
+                NEXT_INS;
+            NUM9_LAB:
+                pc.move(curr_dir);
+                if (!mem.push(9)) {
+                    goto OVERFLOW_LAB;
+                }
+                NEXT_INS;
+            NULL_LAB:
+                pc.move(curr_dir);
+                NEXT_INS;
+            END_LAB:
+                mem.on_exit();
+                return status = HALTED;
+
+            // heap instructions, only decoded when Memory has a heap
+            CONS_LAB:
+                if constexpr (Memory::has_heap) {
+                    value1 = mem.pop();
+                    value2 = mem.pop();
+                    value1 = mem.allocate(value2, value1, pc.x, pc.y);
+                    if (value1 == 0) {
+                        return fail(OUT_OF_MEMORY, "Out of memory");
+                    }
+                    pc.move(curr_dir);
+                    mem.push(value1);
+                    NEXT_INS;
+                }
+                goto INVALID_LAB;
+            HEAD_LAB:
+                if constexpr (Memory::has_heap) {
+                    pc.move(curr_dir);
+                    value1 = mem.pop();
+
+                    if (mem.is_cons(value1)) {
+                        mem.push(mem.get_head(value1));
+                    } else {
+                        return fail(INVALID_DEREFERENCE, "Invalid dereference " + std::to_string(value1));
+                    }
+                    NEXT_INS;
+                }
+                goto INVALID_LAB;
+            TAIL_LAB:
+                if constexpr (Memory::has_heap) {
+                    pc.move(curr_dir);
+                    value1 = mem.pop();
+
+                    if (mem.is_cons(value1)) {
+                        mem.push(mem.get_tail(value1));
+                    } else {
+                        return fail(INVALID_DEREFERENCE, "Invalid dereference " + std::to_string(value1));
+                    }
+                    NEXT_INS;
+                }
+                goto INVALID_LAB;
+
+            // vectors: n a, v i r, x v i w, v l
+            VECTOR_LAB:
+                if constexpr (Memory::has_heap) {
+                    value1 = mem.pop();
+                    if (value1 < 0) {
+                        return fail(INVALID_VALUE, "Invalid vector length " + std::to_string(value1));
+                    }
+                    value1 = mem.allocate_vector(value1, pc.x, pc.y);
+                    if (value1 == 0) {
+                        return fail(OUT_OF_MEMORY, "Out of memory");
+                    }
+                    pc.move(curr_dir);
+                    mem.push(value1);
+                    NEXT_INS;
+                }
+                goto INVALID_LAB;
+            VGET_LAB:
+                if constexpr (Memory::has_heap) {
+                    pc.move(curr_dir);
+                    value2 = mem.pop();
+                    value1 = mem.pop();
+                    if (!mem.is_vector(value1)) {
+                        return fail(INVALID_DEREFERENCE, "Invalid dereference " + std::to_string(value1));
+                    }
+                    if (value2 < 0 || value2 >= mem.vector_length(value1)) {
+                        return fail(INVALID_ACCESS, "Vector index " + std::to_string(value2) +
+                                    " out of bounds, length " + std::to_string(mem.vector_length(value1)));
+                    }
+                    mem.push(mem.vector_element(value1, value2));
+                    NEXT_INS;
+                }
+                goto INVALID_LAB;
+            VSET_LAB:
+                if constexpr (Memory::has_heap) {
+                    pc.move(curr_dir);
+                    value2 = mem.pop();
+                    value1 = mem.pop();
+                    Value stored = mem.pop();
+                    if (!mem.is_vector(value1)) {
+                        return fail(INVALID_DEREFERENCE, "Invalid dereference " + std::to_string(value1));
+                    }
+                    if (value2 < 0 || value2 >= mem.vector_length(value1)) {
+                        return fail(INVALID_ACCESS, "Vector index " + std::to_string(value2) +
+                                    " out of bounds, length " + std::to_string(mem.vector_length(value1)));
+                    }
+                    mem.set_vector_element(value1, value2, stored);
+                    NEXT_INS;
+                }
+                goto INVALID_LAB;
+            VLEN_LAB:
+                if constexpr (Memory::has_heap) {
+                    pc.move(curr_dir);
+                    value1 = mem.pop();
+                    if (!mem.is_vector(value1)) {
+                        return fail(INVALID_DEREFERENCE, "Invalid dereference " + std::to_string(value1));
+                    }
+                    mem.push(mem.vector_length(value1));
+                    NEXT_INS;
+                }
+                goto INVALID_LAB;
+
+            // static grid mode, the stack holds enough values
+            ADD_NC_LAB:
+                pc.move(curr_dir);
+                value2 = mem.pop_unchecked();
+                value1 = mem.pop_unchecked();
+                mem.push(value1 + value2);
+                NEXT_INS;
+            SUB_NC_LAB:
+                pc.move(curr_dir);
+                value2 = mem.pop_unchecked();
+                value1 = mem.pop_unchecked();
+                mem.push(value1 - value2);
+                NEXT_INS;
+            MUL_NC_LAB:
+                pc.move(curr_dir);
+                value2 = mem.pop_unchecked();
+                value1 = mem.pop_unchecked();
+                mem.push(value1 * value2);
+                NEXT_INS;
+            DIV_NC_LAB:
+                pc.move(curr_dir);
+                value2 = mem.pop_unchecked();
+                value1 = mem.pop_unchecked();
+                if (value2 == 0) {
+                    return fail(DIVISION_BY_ZERO, "Error: Division by zero");
+                }
+                mem.push(value1 / value2);
+                NEXT_INS;
+            MOD_NC_LAB:
+                pc.move(curr_dir);
+                value2 = mem.pop_unchecked();
+                value1 = mem.pop_unchecked();
+                if (value2 == 0) {
+                    return fail(DIVISION_BY_ZERO, "Error: Division by zero");
+                }
+                mem.push(value1 % value2);
+                NEXT_INS;
+            NOT_NC_LAB:
+                pc.move(curr_dir);
+                value1 = mem.pop_unchecked();
+                mem.push(value1 != 0? 0: 1);
+                NEXT_INS;
+            GT_NC_LAB:
+                pc.move(curr_dir);
+                value2 = mem.pop_unchecked();
+                value1 = mem.pop_unchecked();
+                mem.push(value1 > value2? 1 : 0 );
+                NEXT_INS;
+            HORIF_NC_LAB:
+                value1 = mem.pop_unchecked();
+                if constexpr (Profiled) {
+                    ++profile->branches[pc.y][pc.x][value1 != 0];
+                }
+                curr_dir = value1 == 0 ? RIGHT: LEFT;
+                pc.move(curr_dir);
+                NEXT_INS;
+            VERTIF_NC_LAB:
+                value1 = mem.pop_unchecked();
+                if constexpr (Profiled) {
+                    ++profile->branches[pc.y][pc.x][value1 != 0];
+                }
+                curr_dir = value1 == 0 ? DOWN: UP;
+                pc.move(curr_dir);
+                NEXT_INS;
+            POP_NC_LAB:
+                pc.move(curr_dir);
+                mem.pop_unchecked();
+                NEXT_INS;
+            OUTI_NC_LAB:
+                pc.move(curr_dir);
+                value1 = mem.pop_unchecked();
+                io.write_int(value1);
+                NEXT_INS;
+            OUTC_NC_LAB:
+                pc.move(curr_dir);
+                value1 = mem.pop_unchecked();
+                io.write_char((char)value1);
+                NEXT_INS;
+
+            INVALID_LAB:
+                return fail(INVALID_COMMAND, std::string("Invalid command detected << ") +
+                            bytecode_to_char(FETCH(pc.x, pc.y)) + " >> at " + std::to_string(pc.y) +
+                            "," + std::to_string(pc.x) + ". Exiting.");
+
+            OVERFLOW_LAB:
+                return fail(STACK_OVERFLOW, "Stack overflow");
+
+            // IR segments, the segment checked the stack depth on entry
+            IR_PUSH_LAB:
+                if (!mem.push((Value)ip->k)) {
+                    goto OVERFLOW_LAB;
+                }
+                NEXT_IR;
+            IR_ADD_LAB:
+                value2 = mem.pop_unchecked();
+                value1 = mem.pop_unchecked();
+                mem.push(value1 + value2);
+                NEXT_IR;
+            IR_SUB_LAB:
+                value2 = mem.pop_unchecked();
+                value1 = mem.pop_unchecked();
+                mem.push(value1 - value2);
+                NEXT_IR;
+            IR_MUL_LAB:
+                value2 = mem.pop_unchecked();
+                value1 = mem.pop_unchecked();
+                mem.push(value1 * value2);
+                NEXT_IR;
+            IR_DIV_LAB:
+                value2 = mem.pop_unchecked();
+                value1 = mem.pop_unchecked();
+                if (value2 == 0) {
+                    return fail(DIVISION_BY_ZERO, "Error: Division by zero");
+                }
+                mem.push(value1 / value2);
+                NEXT_IR;
+            IR_MOD_LAB:
+                value2 = mem.pop_unchecked();
+                value1 = mem.pop_unchecked();
+                if (value2 == 0) {
+                    return fail(DIVISION_BY_ZERO, "Error: Division by zero");
+                }
+                mem.push(value1 % value2);
+                NEXT_IR;
+            IR_GT_LAB:
+                value2 = mem.pop_unchecked();
+                value1 = mem.pop_unchecked();
+                mem.push(value1 > value2? 1 : 0);
+                NEXT_IR;
+            IR_NOT_LAB:
+                value1 = mem.pop_unchecked();
+                mem.push(value1 != 0? 0: 1);
+                NEXT_IR;
+            IR_DUP_LAB:
+                if (!mem.dup()) {
+                    goto OVERFLOW_LAB;
+                }
+                NEXT_IR;
+            IR_SWAP_LAB:
+                mem.swap();
+                NEXT_IR;
+            IR_POP_LAB:
+                mem.pop_unchecked();
+                NEXT_IR;
+            IR_OUTI_LAB:
+                io.write_int(mem.pop_unchecked());
+                NEXT_IR;
+            IR_OUTC_LAB:
+                io.write_char((char)mem.pop_unchecked());
+                NEXT_IR;
+            IR_ADDK_LAB:
+                value1 = mem.pop_unchecked();
+                mem.push((Value)((Bits)value1 + (Bits)ip->k));
+                NEXT_IR;
+            IR_MULK_LAB:
+                value1 = mem.pop_unchecked();
+                mem.push((Value)((Bits)value1 * (Bits)ip->k));
+                NEXT_IR;
+            IR_DIVK_LAB:
+                value1 = mem.pop_unchecked();
+                mem.push(value1 / (Value)ip->k);
+                NEXT_IR;
+            IR_MODK_LAB:
+                value1 = mem.pop_unchecked();
+                mem.push(value1 % (Value)ip->k);
+                NEXT_IR;
+            IR_GTK_LAB:
+                value1 = mem.pop_unchecked();
+                mem.push(value1 > (Value)ip->k? 1 : 0);
+                NEXT_IR;
+            IR_SHLK_LAB:
+                value1 = mem.pop_unchecked();
+                mem.push((Value)((Bits)value1 << ip->k));
+                NEXT_IR;
+            IR_SHRK_LAB:
+                // negative values are biased to round towards zero
+                value1 = mem.pop_unchecked();
+                value2 = (Value)((Bits)(value1 >> sign_shift) & (((Bits)1 << ip->k) - 1));
+                mem.push((value1 + value2) >> ip->k);
+                NEXT_IR;
+            IR_MODP2_LAB:
+                value1 = mem.pop_unchecked();
+                value2 = (Value)((Bits)(value1 >> sign_shift) & (((Bits)1 << ip->k) - 1));
+                value2 = (value1 + value2) >> ip->k;
+                mem.push((Value)((Bits)value1 - ((Bits)value2 << ip->k)));
+                NEXT_IR;
+            IR_EXIT_LAB:
+                // the cell after the segment, charged as NEXT_INS
+                // would but not looked up again
+                pc.x = segment->exit_x;
+                pc.y = segment->exit_y;
+                curr_dir = segment->exit_dir;
+                if constexpr (Budgeted) {
+                    if (--budget < 0) {
+                        return status = BUDGET_EXHAUSTED;
+                    }
+                }
+                if constexpr (Profiled) {
+                    ++profile->visits[(pc.y * Profile::width + pc.x) * 4 + curr_dir];
+                }
+                jump_location = FETCH(pc.x, pc.y);
+                goto *(command_table[jump_location < N_DISPATCH? jump_location: N_COMMANDS]);
+            #undef NEXT_IR
+            #undef NEXT_INS
+            #undef FETCH
+        }
+};
+#endif
@@ -0,0 +1,183 @@
+#ifndef INCLUDE_VMPOOL_HPP
+    #define INCLUDE_VMPOOL_HPP
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <climits>
+#include "vmcore.hpp"
+
+// One program run many times over on VMs built once, what the
+// ensemble and the streaming modes have in common.
+//
+// The program is decoded and analyzed once, by the first VM, and
+// loaded into every VM. A run starts it over (reload(): the grid is
+// copied again only if p changed it, the stack and the heap are
+// emptied) with an input and a seed of its own. run_all() spreads
+// runs over one thread per VM, which take them off a shared counter.
+struct RunResult {
+    RunStatus status;
+    long long instructions;
+    std::string output;
+    std::string error;
+
+    RunResult(): status(BUDGET_EXHAUSTED), instructions(0) {}
+};
+
+// The interpreter options of the command line, set on every VM of a
+// pool or of the server (configure() takes them as they are) and on
+// the VM of a single run, so that a new option reaches all of them
+struct VMOptions {
+    bool fast_mode;
+    bool lifting;
+    bool unbounded;
+    // befunge93+ only
+    int mark_threads;
+    bool hash_cons;
+    bool cdr_coding;
+    int heap_cells; // 0 for the whole heap
+
+    VMOptions(): fast_mode(true), lifting(false), unbounded(false), mark_threads(1), hash_cons(false),
+        cdr_coding(true), heap_cells(0) {}
+
+    template <typename VM>
+    void operator()(VM& vm) const {
+        vm.set_fast_mode(fast_mode);
+        vm.set_lifting(lifting);
+        vm.set_unbounded(unbounded);
+        if constexpr (VM::memory_type::has_heap) {
+            vm.set_mark_threads(mark_threads);
+            vm.set_hash_consing(hash_cons);
+            vm.set_cdr_coding(cdr_coding);
+            if (heap_cells > 0) {
+                vm.set_heap_cells(heap_cells);
+            }
+        }
+    }
+};
+
+// the whole file in contents, false if it cannot be opened
+inline bool read_file(const char* path, std::string& contents) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    contents = buffer.str();
+    return true;
+}
+
+template <typename EmbeddedVM>
+class VMPool {
+    private:
+        // run() slice between limit checks
+        static const long long slice = 1 << 16;
+
+        DecodedProgram decoded;
+
+    protected:
+        std::vector<std::unique_ptr<EmbeddedVM>> pool;
+
+        // the program from the start over input, ? seeded with seed
+        void run_one(EmbeddedVM& vm, const std::string& input, unsigned long long seed,
+                     long long max_instructions, RunResult& result) {
+            vm.reload(decoded);
+            vm.set_seed(seed);
+
+            BufferIO& io = vm.get_io();
+            io.reset();
+            io.feed(input);
+            io.close_input();
+
+            RunStatus status;
+            do {
+                status = vm.run(std::min(slice, max_instructions - vm.stats().instructions));
+            } while (status == BUDGET_EXHAUSTED && vm.stats().instructions < max_instructions);
+
+            result.status = status;
+            result.instructions = vm.stats().instructions;
+            result.output = io.output();
+            result.error.clear();
+            if (is_error(status)) {
+                result.error = vm.error_message();
+            } else if (status == BUDGET_EXHAUSTED) {
+                result.error = "Instruction limit reached";
+            }
+        }
+
+        // run i of count gets input_of(i) and first_seed + i, its
+        // result goes to results[i]
+        template <typename InputOf, typename Result>
+        void run_all(long long count, InputOf input_of, unsigned long long first_seed,
+                     long long max_instructions, std::vector<Result>& results) {
+            std::atomic<long long> next(0);
+            auto work = [&](EmbeddedVM* vm) {
+                for (long long i = next++; i < count; i = next++) {
+                    run_one(*vm, input_of(i), first_seed + i, max_instructions, results[i]);
+                }
+            };
+
+            std::vector<std::thread> workers;
+            for (size_t t = 1; t < pool.size() && (long long)t < count; t++) {
+                workers.emplace_back(work, pool[t].get());
+            }
+            work(pool[0].get());
+            for (std::thread& worker : workers) {
+                worker.join();
+            }
+        }
+
+    public:
+        VMPool(int threads) {
+            for (int i = 0; i < std::max(threads, 1); i++) {
+                pool.emplace_back(new EmbeddedVM());
+            }
+        }
+
+        // apply the interpreter options to every VM
+        template <typename Setup>
+        void configure(Setup setup) {
+            for (std::unique_ptr<EmbeddedVM>& vm : pool) {
+                setup(*vm);
+            }
+        }
+
+        // decode and analyze, false (and the reason in
+        // error_message()) when the program does not fit the grid
+        bool load_source(const std::string& source) {
+            if (!pool[0]->load_source(source)) {
+                return false;
+            }
+            pool[0]->save_decoded(decoded);
+            for (std::unique_ptr<EmbeddedVM>& vm : pool) {
+                vm->load_decoded(decoded);
+            }
+            return true;
+        }
+
+        const std::string& error_message() {
+            return pool[0]->error_message();
+        }
+
+        // load_source() of the file, the reason on stderr if it fails
+        bool load_file(const char* path) {
+            std::string source;
+            if (!read_file(path, source)) {
+                std::cerr << "Unable to open file" << std::endl;
+                return false;
+            }
+            if (!load_source(source)) {
+                std::cerr << error_message() << std::endl;
+                return false;
+            }
+            return true;
+        }
+};
+
+#endif
@@ -0,0 +1,436 @@
+#ifdef PLUS
+#include "../befunge93+/include/befungeplus.hpp"
+#else
+#include "../befunge93/include/befunge.hpp"
+#endif
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <memory>
+#include <cstring>
+
+// Differential conformance harness.
+//
+// Runs programs through the reference engine (no static grid mode,
+// no lifting, one run() call) and every optimized engine, all seeded
+// alike so ? agrees, and compares status, error, output, the final
+// stack, the instructions run (unless it failed) and, for befunge93+, the heap cells the
+// stack reaches. The
+// programs are random, biased towards p and g on the program itself,
+// rows that wrap around the torus and pops of an empty stack, or
+// the files given on the command line. A mismatch is minimized by
+// blanking cells while it persists and written to mismatch_<n>.bf.
+
+struct Engine {
+    const char* name;
+    bool static_grid;
+    bool lifting;
+    long long slice;   // run() budget per call, 0 for one call
+    bool hash_consing; // shares cells, so prints other addresses
+    bool unbounded;    // g and p outside 80x25 go on instead of failing
+};
+
+static const Engine engines[] = {
+    {"reference", false, false, 0, false, false},
+    {"static-grid", true, false, 0, false, false},
+    {"lift", false, true, 0, false, false},
+    {"lift+static-grid", true, true, 0, false, false},
+    {"sliced", true, true, 7, false, false},
+    {"unbounded", false, false, 0, false, true},
+#ifdef PLUS
+    {"hash-cons", true, true, 0, true, false},
+#endif
+};
+static const int n_engines = sizeof(engines) / sizeof(engines[0]);
+
+struct Outcome {
+    RunStatus status;
+    bool finished;     // halted or failed within the instruction limit
+    std::string error;
+    std::string output;
+    std::string stack;
+    long long depth;
+    long long instructions;
+    bool allocated;    // cells were made, output may show addresses
+};
+
+struct Options {
+    long long max_instructions = 100000;
+    unsigned long long seed = 1;
+    int count = 1000;
+    bool verbose = false;
+};
+
+static Options options;
+
+// values from the top of the final stack that are compared
+static const size_t max_described = 64;
+
+// a stack value, cells written out by shape instead of address
+static void describe(EmbeddedVM& vm, signed long long value, std::string& out, int depth) {
+#ifdef PLUS
+    if (vm.is_cell(value)) {
+        if (depth > 64) {
+            out += "(...)";
+            return;
+        }
+        out += "(";
+        describe(vm, vm.head_of(value), out, depth + 1);
+        out += " . ";
+        describe(vm, vm.tail_of(value), out, depth + 1);
+        out += ")";
+        return;
+    }
+    if (vm.is_vector(value)) {
+        if (depth > 64) {
+            out += "[...]";
+            return;
+        }
+        out += "[";
+        std::vector<signed long long> elements = vm.vector_of(value);
+        for (size_t i = 0; i < elements.size() && i < max_described; i++) {
+            out += i > 0 ? " " : "";
+            describe(vm, elements[i], out, depth + 1);
+        }
+        out += elements.size() > max_described ? " ...]" : "]";
+        return;
+    }
+#else
+    (void)vm;
+    (void)depth;
+#endif
+    out += std::to_string(value);
+}
+
+// error messages quote pointers as numbers, they only have to
+// agree on which numbers are cells
+static std::string normalize(EmbeddedVM& vm, const std::string& message) {
+#ifdef PLUS
+    std::string out;
+    size_t i = 0;
+    while (i < message.size()) {
+        size_t end = i + (message[i] == '-' ? 1 : 0);
+        while (end < message.size() && isdigit((unsigned char)message[end])) {
+            ++end;
+        }
+        bool number = end > i + (message[i] == '-' ? 1 : 0);
+        signed long long parsed = number ? strtoll(message.c_str() + i, NULL, 10) : 0;
+        if (number && (vm.is_cell(parsed) || vm.is_vector(parsed))) {
+            out += "<cell>";
+            i = end;
+        } else if (number) {
+            out.append(message, i, end - i);
+            i = end;
+        } else {
+            out += message[i++];
+        }
+    }
+    return out;
+#else
+    (void)vm;
+    return message;
+#endif
+}
+
+static Outcome run_engine(EmbeddedVM& vm, const Engine& engine, const std::string& program,
+                          const std::string& input, unsigned long long seed) {
+    vm.set_fast_mode(engine.static_grid);
+    vm.set_lifting(engine.lifting);
+    vm.set_unbounded(engine.unbounded);
+#ifdef PLUS
+    vm.set_hash_consing(engine.hash_consing);
+#endif
+    vm.set_seed(seed);
+
+    Outcome outcome;
+    outcome.allocated = false;
+    outcome.depth = 0;
+    outcome.instructions = 0;
+    BufferIO& io = vm.get_io();
+    io.reset();
+    if (!vm.load_source(program)) {
+        outcome.status = vm.last_status();
+        outcome.finished = true;
+        outcome.error = normalize(vm, vm.error_message());
+        return outcome;
+    }
+    io.feed(input);
+    io.close_input();
+
+#ifdef PLUS
+    int collections = vm.collections();
+#endif
+    RunStatus status;
+    do {
+        long long left = options.max_instructions - vm.stats().instructions;
+        status = vm.run(engine.slice > 0 ? std::min(engine.slice, left) : left);
+    } while (status == BUDGET_EXHAUSTED && vm.stats().instructions < options.max_instructions);
+
+    outcome.status = status;
+    outcome.finished = status != BUDGET_EXHAUSTED;
+    outcome.error = normalize(vm, vm.error_message());
+    outcome.output = io.output();
+    outcome.instructions = vm.stats().instructions;
+#ifdef PLUS
+    outcome.allocated = vm.heap_cells() > 0 || vm.collections() > collections;
+#endif
+    if (vm.stats().stack_size < 0) {
+        // an unchecked pop the static grid mode should not have used
+        outcome.stack = "underflow to " + std::to_string(vm.stats().stack_size);
+    } else if (outcome.finished) {
+        // the depth and the top of the stack, an overflowing
+        // program leaves a million values
+        auto stack = vm.stack_contents();
+        outcome.depth = stack.size();
+        outcome.stack = std::to_string(stack.size()) + ": ";
+        for (size_t i = stack.size() > max_described ? stack.size() - max_described : 0; i < stack.size(); i++) {
+            describe(vm, stack[i], outcome.stack, 0);
+            outcome.stack += " ";
+        }
+    }
+    return outcome;
+}
+
+// why the outcomes differ, empty when they agree. A run cut at the
+// instruction limit only has to agree on the output so far, lifted
+// segments may run past the limit
+static std::string compare(const Outcome& reference, const Outcome& other, const Engine& engine) {
+    if (engine.unbounded && reference.status == INVALID_ACCESS) {
+        // the reference stopped at a g or p off the 80x25 grid
+        if (other.output.compare(0, reference.output.size(), reference.output) != 0) {
+            return "output differs before the access off the grid";
+        }
+        return "";
+    }
+    bool same_output = !engine.hash_consing || !reference.allocated;
+    if (!same_output) {
+        // cells are laid out differently, any arithmetic on a
+        // pointer comes out different, only the shape has to agree
+        if (reference.finished && other.finished && reference.status != other.status) {
+            return "status " + std::to_string(reference.status) + " vs " + std::to_string(other.status);
+        }
+        if (reference.finished && other.finished && reference.depth != other.depth) {
+            return "final stack depth differs";
+        }
+        return "";
+    }
+    if (!reference.finished || !other.finished) {
+        size_t common = std::min(reference.output.size(), other.output.size());
+        if (reference.output.compare(0, common, other.output, 0, common) != 0) {
+            return "output differs before the instruction limit";
+        }
+        if (reference.finished != other.finished && reference.status != WAITING_FOR_INPUT &&
+            other.status != WAITING_FOR_INPUT) {
+            // one stopped where the other kept going, allowed only
+            // for the slack of a segment at the limit
+            const Outcome& stopped = reference.finished ? reference : other;
+            if (stopped.status != HALTED && !is_error(stopped.status)) {
+                return "status differs";
+            }
+        }
+        return "";
+    }
+    if (reference.status != other.status) {
+        return "status " + std::to_string(reference.status) + " vs " + std::to_string(other.status);
+    }
+    if (reference.error != other.error) {
+        return "error message differs";
+    }
+    if (reference.output != other.output) {
+        return "output differs";
+    }
+    // a segment is charged in full when it starts, and an error
+    // partway through it stops short of that
+    if (!is_error(reference.status) && reference.instructions != other.instructions) {
+        return "instructions " + std::to_string(reference.instructions) + " vs " +
+               std::to_string(other.instructions);
+    }
+    if (reference.stack != other.stack) {
+        return "final stack differs";
+    }
+    return "";
+}
+
+class Harness {
+    private:
+        // one VM for every engine, loading resets the heap so
+        // they all hand out the same addresses
+        std::unique_ptr<EmbeddedVM> vm;
+
+    public:
+        Harness(): vm(new EmbeddedVM()) {}
+
+        Outcome run(int engine, const std::string& program, const std::string& input, unsigned long long seed) {
+            return run_engine(*vm, engines[engine], program, input, seed);
+        }
+
+        // first engine that disagrees with the reference, or -1
+        int check(const std::string& program, const std::string& input, unsigned long long seed,
+                  std::string& why, int only = -1) {
+            Outcome reference = run_engine(*vm, engines[0], program, input, seed);
+            for (int i = 1; i < n_engines; i++) {
+                if (only >= 0 && i != only) {
+                    continue;
+                }
+                Outcome other = run_engine(*vm, engines[i], program, input, seed);
+                why = compare(reference, other, engines[i]);
+                if (!why.empty()) {
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        // blank cells and drop lines while the engine still disagrees
+        std::string minimize(std::string program, const std::string& input, unsigned long long seed,
+                             int engine) {
+            std::string why;
+            bool smaller = true;
+            while (smaller) {
+                smaller = false;
+                for (size_t i = 0; i < program.size(); i++) {
+                    if (program[i] == ' ' || program[i] == '\n') {
+                        continue;
+                    }
+                    std::string candidate = program;
+                    candidate[i] = ' ';
+                    if (check(candidate, input, seed, why, engine) == engine) {
+                        program = candidate;
+                        smaller = true;
+                    }
+                }
+
+                size_t last_line = program.rfind('\n', program.size() - 2);
+                if (last_line != std::string::npos) {
+                    std::string candidate = program.substr(0, last_line + 1);
+                    if (check(candidate, input, seed, why, engine) == engine) {
+                        program = candidate;
+                        smaller = true;
+                    }
+                }
+            }
+            return program;
+        }
+};
+
+// small grids of mostly commands, with p and g aimed at the
+// grid itself and the odd row spanning the whole torus
+static std::string random_program(std::mt19937_64& rng) {
+    static const std::string commands =
+        "0123456789" "0123456789" "+-*/%!`" "><^v" "><^v" "_|?" "\"\"" ":\\$" ":\\$" ".," "#"
+        "gpgpgp" "&~" "@" "     "
+#ifdef PLUS
+        "chtcht" "arwl"
+#endif
+        ;
+
+    int width = rng() % 5 == 0 ? 80 : 3 + rng() % 14;
+    int height = 1 + rng() % 6;
+
+    std::string program;
+    for (int y = 0; y < height; y++) {
+        int row_width = width == 80 ? 79 : width;
+        for (int x = 0; x < row_width; x++) {
+            program += commands[rng() % commands.size()];
+        }
+        program += '\n';
+    }
+    return program;
+}
+
+static std::string random_input(std::mt19937_64& rng) {
+    static const std::string characters = "0123456789 -\nab";
+    std::string input;
+    int length = rng() % 24;
+    for (int i = 0; i < length; i++) {
+        input += characters[rng() % characters.size()];
+    }
+    return input;
+}
+
+static void report(Harness& harness, const std::string& program, const std::string& input,
+                   unsigned long long seed, int engine, const std::string& why, int number) {
+    std::string minimized = harness.minimize(program, input, seed, engine);
+    std::string path = "mismatch_" + std::to_string(number) + ".bf";
+    std::ofstream out(path);
+    out << minimized;
+
+    std::cout << "MISMATCH " << engines[engine].name << ": " << why << " (seed " << seed << ")" << std::endl;
+    std::cout << "input: \"" << input << "\"" << std::endl;
+    std::cout << "minimized program, written to " << path << ":" << std::endl << minimized << std::endl;
+
+    Outcome outcomes[2];
+    outcomes[0] = harness.run(0, minimized, input, seed);
+    outcomes[1] = harness.run(engine, minimized, input, seed);
+    for (int i = 0; i < 2; i++) {
+        const Outcome& outcome = outcomes[i];
+        std::cout << engines[i == 0 ? 0 : engine].name << ": status " << outcome.status <<
+        (outcome.finished ? "" : " (at the limit)") << ", output \"" << outcome.output.substr(0, 200) <<
+        "\", stack [" << outcome.stack << "]";
+        if (!outcome.error.empty()) {
+            std::cout << ", " << outcome.error;
+        }
+        std::cout << std::endl;
+    }
+    std::cout << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<const char*> files;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            options.seed = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            options.count = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--max-instructions") == 0 && i + 1 < argc) {
+            options.max_instructions = atoll(argv[++i]);
+        } else if (strcmp(argv[i], "--verbose") == 0) {
+            options.verbose = true;
+        } else {
+            files.push_back(argv[i]);
+        }
+    }
+
+    Harness harness;
+    int mismatches = 0;
+    std::string why;
+
+    if (!files.empty()) {
+        for (size_t i = 0; i < files.size(); i++) {
+            std::ifstream file(files[i]);
+            if (!file.is_open()) {
+                std::cerr << "Unable to open " << files[i] << std::endl;
+                return -1;
+            }
+            std::stringstream contents;
+            contents << file.rdbuf();
+
+            int engine = harness.check(contents.str(), "", options.seed, why);
+            if (engine >= 0) {
+                report(harness, contents.str(), "", options.seed, engine, why, ++mismatches);
+            } else if (options.verbose) {
+                std::cout << files[i] << ": all engines agree" << std::endl;
+            }
+        }
+    } else {
+        std::mt19937_64 rng(options.seed);
+        for (int i = 0; i < options.count; i++) {
+            unsigned long long seed = rng();
+            std::mt19937_64 program_rng(seed);
+            std::string program = random_program(program_rng);
+            std::string input = random_input(program_rng);
+
+            int engine = harness.check(program, input, seed, why);
+            if (engine >= 0) {
+                report(harness, program, input, seed, engine, why, ++mismatches);
+            }
+        }
+    }
+
+    int checked = files.empty() ? options.count : files.size();
+    std::cout << checked << " programs, " << n_engines - 1 << " engines against the reference, " <<
+    mismatches << " mismatches" << std::endl;
+    return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+#ifdef PLUS
+#include "../befunge93+/include/befungeplus.hpp"
+#else
+#include "../befunge93/include/befunge.hpp"
+#endif
+#include "../common/include/compiled.hpp"
+#include <iostream>
+#include <memory>
+
+// Compiled programs against the interpreter.
+//
+// Every program here is compiled with CompiledVM and also loaded
+// from the same source into the reference engine, both seeded alike.
+// Each first runs without input, to stop at & or ~ where the program
+// reads, then gets its input and runs to the end. Status, error,
+// output and the final stack have to match after both runs, with
+// every pointer on the stack taken as the same.
+
+static constexpr bool heap = EmbeddedVM::memory_type::has_heap;
+
+static constexpr char test_source[] = {
+#include "embedded_test.inc"
+    , 0
+};
+static constexpr EmbeddedProgram test_program = embed_program(test_source, heap);
+
+#ifdef PLUS
+static constexpr char vectors_source[] = {
+#include "embedded_vectors.inc"
+    , 0
+};
+static constexpr EmbeddedProgram vectors_program = embed_program(vectors_source, heap);
+
+static constexpr char cons_source[] = "12c:h.t.34c5c:h:h.t.t.67c@";
+static constexpr EmbeddedProgram cons_program = embed_program(cons_source, heap);
+#else
+static constexpr char ops_source[] = {
+#include "embedded_ops.inc"
+    , 0
+};
+static constexpr EmbeddedProgram ops_program = embed_program(ops_source, heap);
+#endif
+
+// digits folded, and arithmetic with one constant operand
+static constexpr char arithmetic_source[] = R"(55+:*3%.96*2/.88*:+.09-3/.09-3%.1:\-.&:3*.:4/.5%.7!.@)";
+static constexpr EmbeddedProgram arithmetic_program = embed_program(arithmetic_source, heap);
+
+// numbers until a 0, then their sum
+static constexpr char input_source[] = R"(0>&:#v_$.@
+ ^  +<)";
+static constexpr EmbeddedProgram input_program = embed_program(input_source, heap);
+
+static constexpr char echo_source[] = "~:1+!#@_,";
+static constexpr EmbeddedProgram echo_program = embed_program(echo_source, heap);
+
+static constexpr char random_source[] = R"(v>1.@
+>?2.v
+ >3.@
+ ^  <)";
+static constexpr EmbeddedProgram random_program = embed_program(random_source, heap);
+
+// p on data, then on a cell the compiled code runs through
+static constexpr char put_source[] = R"("x"73p73g,88*60p1.2.3.@)";
+static constexpr EmbeddedProgram put_program = embed_program(put_source, heap);
+
+static constexpr char divide_source[] = "5&/.@";
+static constexpr EmbeddedProgram divide_program = embed_program(divide_source, heap);
+
+static constexpr char invalid_source[] = "12+.Q@";
+static constexpr EmbeddedProgram invalid_program = embed_program(invalid_source, heap);
+
+struct Result {
+    RunStatus status;
+    std::string output;
+    std::string error;
+    std::vector<signed long long> stack;
+};
+
+template <typename Engine>
+static Result finish(Engine& vm, RunStatus status) {
+    Result result;
+    result.status = status;
+    result.output = vm.get_io().output();
+    result.error = is_error(status) ? vm.error_message() : "";
+    for (auto value : vm.stack_contents()) {
+#ifdef PLUS
+        // addresses differ between heaps
+        if (vm.is_cell(value) || vm.is_vector(value)) {
+            value = -1;
+        }
+#endif
+        result.stack.push_back(value);
+    }
+    return result;
+}
+
+static RunStatus run_reference(EmbeddedVM& vm) {
+    RunStatus status;
+    do {
+        status = vm.run(LLONG_MAX);
+    } while (status == BUDGET_EXHAUSTED);
+    return status;
+}
+
+static bool same(const Result& reference, const Result& compiled, const char* name, const char* phase) {
+    if (reference.status == compiled.status && reference.output == compiled.output &&
+        reference.error == compiled.error && reference.stack == compiled.stack) {
+        return true;
+    }
+    std::cout << "MISMATCH " << name << " " << phase << ": status " << reference.status << " vs " <<
+                 compiled.status << ", output \"" << reference.output << "\" vs \"" << compiled.output <<
+                 "\", error \"" << reference.error << "\" vs \"" << compiled.error << "\", stack " <<
+                 reference.stack.size() << " vs " << compiled.stack.size() << " values" << std::endl;
+    return false;
+}
+
+template <const EmbeddedProgram& Program>
+static bool check(const char* name, const char* source, const std::string& input) {
+    std::unique_ptr<EmbeddedVM> reference(new EmbeddedVM());
+    reference->set_fast_mode(false);
+    reference->set_seed(1);
+    reference->load_source(source);
+
+    std::unique_ptr<CompiledVM<Program, EmbeddedVM>> compiled(new CompiledVM<Program, EmbeddedVM>());
+    compiled->set_seed(1);
+
+    if (!same(finish(*reference, run_reference(*reference)), finish(*compiled, compiled->run()), name,
+              "before input")) {
+        return false;
+    }
+
+    reference->get_io().feed(input);
+    reference->get_io().close_input();
+    compiled->get_io().feed(input);
+    compiled->get_io().close_input();
+    if (!same(finish(*reference, run_reference(*reference)), finish(*compiled, compiled->run()), name,
+              "with input")) {
+        return false;
+    }
+
+    std::cout << "ok " << name << " (" << CompiledVM<Program, EmbeddedVM>::entry_states() << " states)" << std::endl;
+    return true;
+}
+
+int main() {
+    bool ok = true;
+    ok &= check<test_program>("test", test_source, "");
+#ifdef PLUS
+    ok &= check<vectors_program>("vectors", vectors_source, "");
+    ok &= check<cons_program>("cons", cons_source, "");
+#else
+    ok &= check<ops_program>("ops", ops_source, "");
+#endif
+    ok &= check<arithmetic_program>("arithmetic", arithmetic_source, "-17\n");
+    ok &= check<input_program>("input", input_source, "3 4\n5\n0\n");
+    ok &= check<echo_program>("echo", echo_source, "echo\nthis\n");
+    ok &= check<random_program>("random", random_source, "");
+    ok &= check<put_program>("put", put_source, "");
+    ok &= check<divide_program>("divide", divide_source, "0\n");
+    ok &= check<invalid_program>("invalid", invalid_source, "");
+    return ok ? 0 : -1;
+}
@@ -0,0 +1,337 @@
+#include "../befunge93+/include/befungeplus.hpp"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+// GC benchmarks for befunge93+.
+//
+// Every benchmark is a program in programs/ that reads its sizes as
+// numbers on input, sized from the heap of the configuration so that
+// the collector has the same share of work in a small heap as in a
+// large one. Each run gets a child process of its own, so the peak
+// RSS is that of the run alone, and the heap and stack are mapped
+// with the pages the configuration asks for. Reported per run: the
+// run time, allocations per second over the whole run, collections,
+// their total and longest pause, the most cells in use at once and
+// the peak RSS, and with huge pages what the heap and stack got.
+
+struct Config {
+    std::string name;
+    int heap_cells;
+    int mark_threads;
+    bool hash_cons;
+    PageKind pages;
+    bool cdr_coding;
+};
+
+struct Benchmark {
+    const char* name;
+    const char* file;
+    const char* what;
+};
+
+static const Benchmark benchmarks[] = {
+    {"long_lived", "long_lived.b", "a list of a quarter heap kept alive through churn"},
+    {"churn", "churn.b", "cells dropped right after they are made"},
+    {"deep_tail", "deep_tail.b", "one tail chain growing to most of the heap"},
+    {"deep_head", "deep_head.b", "one head chain growing to most of the heap"},
+    {"near_full", "near_full.b", "churn through the free list holes of a 90% full heap"},
+    {"mixed", "mixed.b", "a chain of vectors of 3 to 11 values, short-lived cells and vectors between"},
+    {"deep_stack", "deep_stack.b", "the stack filled to 3/4 and summed, over and over"},
+};
+static const int n_benchmarks = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+// what a child sends back over its pipe
+struct RunResult {
+    int status; // RunStatus
+    long long instructions;
+    double seconds;
+    GCStats gc;
+    char output[32];
+    char error[96];
+    char pages[96]; // what the heap and stack got
+
+    RunResult(): status(HALTED), instructions(0), seconds(0), output(), error(), pages() {}
+};
+
+struct Options {
+    std::string programs = "programs";
+    double scale = 1;
+    std::vector<Config> configs;
+    std::vector<std::string> only;
+};
+
+// input and expected output of a benchmark in a heap of that size
+static void sizes(const std::string& name, int heap_cells, double scale, std::string& input, std::string& expected) {
+    long long heap = heap_cells;
+    long long churn = (long long)(4 * heap * scale);
+    long long n;
+
+    if (name == "long_lived") {
+        n = heap / 4;
+        input = std::to_string(n) + " " + std::to_string(churn);
+    } else if (name == "churn") {
+        input = std::to_string(churn);
+        expected = "0";
+        return;
+    } else if (name == "near_full") {
+        // with a garbage cell after every live one the list
+        // leaves the heap 90% full of holes
+        n = heap * 45 / 100;
+        input = std::to_string(n) + " " + std::to_string(churn);
+    } else if (name == "mixed") {
+        // about 5 live cells and 7 garbage per vector. The heap
+        // does not move cells, the garbage is made larger than
+        // the live vectors so that its holes can take them
+        n = heap * 15 / 100;
+        input = std::to_string(n);
+    } else if (name == "deep_stack") {
+        // befunge93+ stacks hold 1 << 20 values
+        n = (1 << 20) * 3 / 4;
+        input = std::to_string(std::max(1LL, churn / n)) + " " + std::to_string(n);
+        expected = std::to_string(n);
+        return;
+    } else {
+        n = heap * 8 / 10;
+        input = std::to_string(n);
+    }
+    expected = std::to_string(n + 1);
+}
+
+static RunResult run_child(const Config& config, const std::string& path, const std::string& input) {
+    RunResult result;
+
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        result.status = INVALID_PROGRAM;
+        strncpy(result.error, ("Unable to open " + path).c_str(), sizeof(result.error) - 1);
+        return result;
+    }
+    std::stringstream source;
+    source << file.rdbuf();
+
+    PageArray::requested() = config.pages;
+    std::unique_ptr<EmbeddedVM> vm(new EmbeddedVM());
+    vm->set_heap_cells(config.heap_cells);
+    vm->set_mark_threads(config.mark_threads);
+    vm->set_hash_consing(config.hash_cons);
+    vm->set_cdr_coding(config.cdr_coding);
+    if (!vm->load_source(source.str())) {
+        result.status = INVALID_PROGRAM;
+        strncpy(result.error, vm->error_message().c_str(), sizeof(result.error) - 1);
+        return result;
+    }
+    vm->get_io().feed(input);
+    vm->get_io().close_input();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    RunStatus status = vm->run(LLONG_MAX);
+    result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    result.status = status;
+    result.instructions = vm->stats().instructions;
+    result.gc = vm->gc_stats();
+    std::string output = vm->get_io().output();
+    output.erase(output.find_last_not_of(" \n") + 1);
+    strncpy(result.output, output.c_str(), sizeof(result.output) - 1);
+    if (is_error(status)) {
+        strncpy(result.error, vm->error_message().c_str(), sizeof(result.error) - 1);
+    }
+    if (config.pages != SMALL_PAGES) {
+        snprintf(result.pages, sizeof(result.pages), "%s, huge MB: heap %lld/%lld, stack %lld/%lld",
+                 vm->heap_pages().obtained() == EXPLICIT_HUGE_PAGES ? "hugetlb" :
+                 vm->heap_pages().obtained() == TRANSPARENT_HUGE_PAGES ? "thp" : "4K",
+                 vm->heap_pages().huge_bytes() >> 20, (long long)vm->heap_pages().size() >> 20,
+                 vm->stack_pages().huge_bytes() >> 20, (long long)vm->stack_pages().size() >> 20);
+    }
+    return result;
+}
+
+// false when the child died without a result
+static bool run(const Config& config, const std::string& path, const std::string& input,
+                RunResult& result, long& peak_rss_kb) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+
+    pid_t child = fork();
+    if (child == 0) {
+        close(fds[0]);
+        RunResult child_result = run_child(config, path, input);
+        ssize_t written = write(fds[1], &child_result, sizeof(child_result));
+        _exit(written == (ssize_t)sizeof(child_result) ? 0 : 1);
+    }
+    close(fds[1]);
+
+    size_t got = 0;
+    while (child > 0 && got < sizeof(result)) {
+        ssize_t n = read(fds[0], (char*)&result + got, sizeof(result) - got);
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+    }
+    close(fds[0]);
+
+    int wait_status;
+    rusage usage;
+    if (child < 0 || wait4(child, &wait_status, 0, &usage) < 0) {
+        return false;
+    }
+    peak_rss_kb = usage.ru_maxrss;
+    return got == sizeof(result);
+}
+
+static void header(std::ostream& out) {
+    out << std::left << std::setw(11) << "benchmark" << std::setw(18) << "config" << std::right
+        << std::setw(8) << "run s" << std::setw(11) << "allocs" << std::setw(11) << "allocs/s" << std::setw(6) << "GCs"
+        << std::setw(10) << "gc ms" << std::setw(10) << "max ms" << std::setw(11) << "peak cells"
+        << std::setw(9) << "RSS MB" << "  output" << std::endl;
+}
+
+static void row(std::ostream& out, const Benchmark& benchmark, const Config& config, const RunResult& result,
+                long peak_rss_kb, bool correct) {
+    out << std::left << std::setw(11) << benchmark.name << std::setw(18) << config.name << std::right
+        << std::fixed << std::setprecision(2) << std::setw(8) << result.seconds << std::defaultfloat
+        << std::setw(11) << result.gc.allocations
+        << std::setw(11) << std::setprecision(3) << std::scientific
+        << (result.seconds > 0 ? result.gc.allocations / result.seconds : 0.0) << std::defaultfloat
+        << std::setw(6) << result.gc.collections << std::fixed << std::setprecision(1)
+        << std::setw(10) << result.gc.pause_ns / 1e6 << std::setw(10) << result.gc.max_pause_ns / 1e6
+        << std::defaultfloat << std::setw(11) << result.gc.peak_cells
+        << std::setw(9) << peak_rss_kb / 1024 << "  " << result.output << (correct ? "" : " WRONG");
+    if (result.error[0] != '\0') {
+        out << " (" << result.error << ")";
+    }
+    if (result.pages[0] != '\0') {
+        out << " [" << result.pages << "]";
+    }
+    out << std::endl;
+}
+
+static std::string heap_name(int cells) {
+    if (cells % (1 << 20) == 0) {
+        return std::to_string(cells >> 20) + "M";
+    }
+    if (cells % (1 << 10) == 0) {
+        return std::to_string(cells >> 10) + "K";
+    }
+    return std::to_string(cells);
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    int heap_cells = 0;
+    int mark_threads = 1;
+    bool hash_cons = false;
+    bool cdr_coding = true;
+    PageKind pages = SMALL_PAGES;
+    bool custom = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--programs") == 0 && i + 1 < argc) {
+            options.programs = argv[++i];
+        } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+            // churn is 4 * scale heaps of cells
+            options.scale = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--heap-cells") == 0 && i + 1 < argc) {
+            custom = true;
+            heap_cells = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--mark-threads") == 0 && i + 1 < argc) {
+            custom = true;
+            mark_threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--hash-cons") == 0) {
+            custom = true;
+            hash_cons = true;
+        } else if (strcmp(argv[i], "--no-cdr-coding") == 0) {
+            custom = true;
+            cdr_coding = false;
+        } else if (strcmp(argv[i], "--huge-pages") == 0 && i + 1 < argc) {
+            custom = true;
+            if (!PageArray::parse(argv[++i], pages)) {
+                std::cerr << "Unknown page mode " << argv[i] << ", expected off, transparent or explicit" << std::endl;
+                exit(-1);
+            }
+        } else if (strcmp(argv[i], "--list") == 0) {
+            for (int b = 0; b < n_benchmarks; b++) {
+                std::cout << std::left << std::setw(11) << benchmarks[b].name << benchmarks[b].what << std::endl;
+            }
+            return 0;
+        } else if (argv[i][0] != '-') {
+            options.only.push_back(argv[i]);
+        } else {
+            std::cerr << "Unknown option " << argv[i] << std::endl;
+            exit(-1);
+        }
+    }
+
+    if (custom) {
+        // one configuration from the options
+        int cells = heap_cells > 0 ? std::min(heap_cells, Heap::max_capacity()) : 1 << 22;
+        std::string name = heap_name(cells);
+        if (mark_threads > 1) {
+            name += " mark" + std::to_string(mark_threads);
+        }
+        if (hash_cons) {
+            name += " hash-cons";
+        }
+        if (!cdr_coding) {
+            name += " no-cdr";
+        }
+        if (pages != SMALL_PAGES) {
+            name += pages == EXPLICIT_HUGE_PAGES ? " hugetlb" : " thp";
+        }
+        options.configs.push_back({name, cells, mark_threads, hash_cons, pages, cdr_coding});
+    } else {
+        options.configs.push_back({"1M", 1 << 20, 1, false, SMALL_PAGES, true});
+        options.configs.push_back({"4M", 1 << 22, 1, false, SMALL_PAGES, true});
+        options.configs.push_back({"4M no-cdr", 1 << 22, 1, false, SMALL_PAGES, false});
+        options.configs.push_back({"4M hash-cons", 1 << 22, 1, true, SMALL_PAGES, true});
+        options.configs.push_back({"4M thp", 1 << 22, 1, false, TRANSPARENT_HUGE_PAGES, true});
+    }
+
+    header(std::cout);
+    int failures = 0;
+    for (int b = 0; b < n_benchmarks; b++) {
+        const Benchmark& benchmark = benchmarks[b];
+        if (!options.only.empty() &&
+            std::find(options.only.begin(), options.only.end(), benchmark.name) == options.only.end()) {
+            continue;
+        }
+
+        for (const Config& config : options.configs) {
+            std::string input, expected;
+            sizes(benchmark.name, config.heap_cells, options.scale, input, expected);
+
+            RunResult result;
+            long peak_rss_kb = 0;
+            if (!run(config, options.programs + "/" + benchmark.file, input, result, peak_rss_kb)) {
+                std::cout << std::left << std::setw(11) << benchmark.name << std::setw(18) << config.name
+                          << "crashed" << std::endl;
+                ++failures;
+                continue;
+            }
+
+            bool correct = result.status == HALTED && expected == result.output;
+            row(std::cout, benchmark, config, result, peak_rss_kb, correct);
+            if (!correct) {
+                ++failures;
+            }
+        }
+    }
+
+    if (failures > 0) {
+        std::cerr << failures << " runs failed" << std::endl;
+        return -1;
+    }
+    return 0;
+}
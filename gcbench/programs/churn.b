@@ -0,0 +1,2 @@
+&>:0c:1cc$1-:v
+ ^           _.@
@@ -0,0 +1,4 @@
+0&c>:t1-c00c$:tv
+   ^           _0\v
+                  >h\1+\:v
+                  ^      _$.@
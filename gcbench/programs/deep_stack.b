@@ -0,0 +1,4 @@
+&&>\:#v_$.@
+      >1-\01-\>    :#v_$0>\:1+#v_$v
+              ^  -1\1<   ^    +<
+  ^                               <
@@ -0,0 +1,4 @@
+&0c>:h1-\c00c$:hv
+   ^            _0\v
+                   >t\1+\:v
+                   ^      _$.@
@@ -0,0 +1,6 @@
+&0c>:h1-\c:hv
+   ^        _&v
+              >:0c$1-:v
+              ^       _$0\v
+                          >t\1+\:v
+                          ^      _$.@
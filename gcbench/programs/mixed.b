@@ -0,0 +1,4 @@
+3a&c:h\:t\h0w>:0r1-:9%3+a\c:h\:t\h0w\c:h\:t\h1w:0r88+%a$:0rv
+             ^                                             _0\v
+                                                              >1r\1+\:v
+                                                              ^       _$.@
@@ -0,0 +1,197 @@
+#include "../common/include/vmcore.hpp"
+#include "../common/include/tracer.hpp"
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <map>
+#include <tuple>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+// Decoder of the traces --trace writes.
+//
+// Prints what the trace holds and how the run ended, the hottest
+// cells, the hottest paths and the last records before the end. A
+// path is a straight run of instructions up to the next one that
+// can turn the PC, so a loop shows up as the few paths it is made
+// of, each with the number of times it ran.
+
+static const char* status_names[] = {"HALTED", "BUDGET_EXHAUSTED", "WAITING_FOR_INPUT", "DIVISION_BY_ZERO",
+                                     "STACK_OVERFLOW", "OUT_OF_MEMORY", "INVALID_COMMAND", "INVALID_ACCESS",
+                                     "INVALID_VALUE", "INVALID_DEREFERENCE", "INVALID_PROGRAM"};
+static_assert(sizeof(status_names) / sizeof(status_names[0]) == INVALID_PROGRAM + 1, "a name per RunStatus");
+
+static char to_char(unsigned int bytecode) {
+    // the static grid mode marks cells above UNCHECKED_BASE
+    if (bytecode >= (unsigned int)UNCHECKED_BASE && bytecode < 1000) {
+        bytecode -= UNCHECKED_BASE;
+    }
+    return bytecode < (unsigned int)UNCHECKED_BASE ? charset[bytecode] : (char)(bytecode - 1000);
+}
+
+static bool turns(char c) {
+    return c == '>' || c == '<' || c == '^' || c == 'v' || c == '_' || c == '|' || c == '?' || c == '@';
+}
+
+static char arrow(int d) {
+    static const char arrows[] = {'^', 'v', '<', '>'};
+    return d >= 0 && d < 4 ? arrows[d] : '?';
+}
+
+static std::string cell(const TraceRecord& r) {
+    return std::to_string(r.x) + "," + std::to_string(r.y);
+}
+
+static void print_record(std::ostream& out, unsigned long long index, const TraceRecord& r) {
+    out << std::setw(12) << index << "  ";
+    switch (r.event) {
+    case TRACE_INSTRUCTION:
+        out << std::left << std::setw(10) << cell(r) << std::right << arrow(r.dir) << " '" << to_char(r.op)
+            << "'  top " << r.value;
+        break;
+    case TRACE_ALLOCATE:
+        // the address, without the pointer tag in bit 63
+        out << std::left << std::setw(10) << cell(r) << std::right << "allocate " << r.op << " cell"
+            << (r.op == 1 ? "" : "s") << " at 0x" << std::hex << ((unsigned long long)r.value & ~(1ULL << 63))
+            << std::dec;
+        break;
+    case TRACE_GC_START:
+        out << "gc start, " << r.value << " cells in use";
+        break;
+    case TRACE_GC_END:
+        out << "gc end, " << r.value << " cells in use";
+        break;
+    case TRACE_END:
+        out << std::left << std::setw(10) << cell(r) << std::right << "end "
+            << (r.value >= 0 && r.value <= INVALID_PROGRAM ? status_names[r.value] : "?");
+        break;
+    default:
+        out << "unknown event " << (int)r.event;
+    }
+    out << std::endl;
+}
+
+int main(int argc, char *argv[]) {
+    const char* path = NULL;
+    unsigned long long last = 20;
+    size_t top = 10;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--last") == 0 && i + 1 < argc) {
+            last = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+            top = strtoull(argv[++i], NULL, 10);
+        } else if (path == NULL) {
+            path = argv[i];
+        } else {
+            std::cerr << "Usage: tracedump [--last N] [--top K] FILE" << std::endl;
+            exit(-1);
+        }
+    }
+    if (path == NULL) {
+        std::cerr << "Usage: tracedump [--last N] [--top K] FILE" << std::endl;
+        exit(-1);
+    }
+
+    std::ifstream file(path, std::ios::binary);
+    TraceHeader header;
+    if (!file.read((char*)&header, sizeof(header)) || memcmp(header.magic, trace_magic, sizeof(trace_magic)) != 0) {
+        std::cerr << path << " is not a trace" << std::endl;
+        exit(-1);
+    }
+    if (header.version != trace_version || header.record_size != sizeof(TraceRecord)) {
+        std::cerr << path << " is a trace of version " << header.version << ", expected " << trace_version << std::endl;
+        exit(-1);
+    }
+
+    std::vector<TraceRecord> records;
+    TraceRecord record;
+    while (file.read((char*)&record, sizeof(record))) {
+        records.push_back(record);
+    }
+    // the index of the first record kept among all recorded
+    unsigned long long first = header.recorded - records.size();
+
+    typedef std::tuple<unsigned int, unsigned int, int, char> Cell;
+    typedef std::tuple<unsigned int, unsigned int, int, std::string> Path;
+    std::map<Cell, unsigned long long> cells;
+    std::map<Path, unsigned long long> paths;
+    unsigned long long instructions = 0, allocations = 0, allocated_cells = 0, collections = 0;
+    const TraceRecord* end = NULL;
+
+    const TraceRecord* start = NULL;
+    std::string text;
+    for (const TraceRecord& r : records) {
+        if (r.event == TRACE_ALLOCATE) {
+            ++allocations;
+            allocated_cells += r.op;
+        } else if (r.event == TRACE_GC_START) {
+            ++collections;
+        } else if (r.event == TRACE_END) {
+            end = &r;
+        }
+        if (r.event != TRACE_INSTRUCTION) {
+            continue;
+        }
+
+        ++instructions;
+        char c = to_char(r.op);
+        ++cells[Cell(r.x, r.y, r.dir, c)];
+        if (start == NULL) {
+            start = &r;
+            text.clear();
+        }
+        text += c;
+        if (turns(c) || text.size() >= 80) {
+            ++paths[Path(start->x, start->y, start->dir, text)];
+            start = NULL;
+        }
+    }
+
+    std::cout << records.size() << " records of " << header.recorded << " recorded";
+    if (first > 0) {
+        std::cout << ", the first " << first << " overwritten";
+    }
+    std::cout << std::endl << instructions << " instructions, " << allocations << " allocations (" << allocated_cells
+              << " cells), " << collections << " collections" << std::endl;
+    if (end != NULL) {
+        std::cout << "ended with " << (end->value >= 0 && end->value <= INVALID_PROGRAM ? status_names[end->value] : "?")
+                  << " at " << cell(*end) << std::endl;
+    } else {
+        std::cout << "no end record, the process was killed, crashed or is still running" << std::endl;
+    }
+
+    std::vector<std::pair<unsigned long long, Cell>> hot_cells;
+    for (const std::pair<const Cell, unsigned long long>& entry : cells) {
+        hot_cells.push_back(std::make_pair(entry.second, entry.first));
+    }
+    std::sort(hot_cells.rbegin(), hot_cells.rend());
+    std::cout << std::endl << "hot cells" << std::endl;
+    for (size_t i = 0; i < hot_cells.size() && i < top; i++) {
+        const Cell& c = hot_cells[i].second;
+        std::cout << std::setw(12) << hot_cells[i].first << "  " << std::left << std::setw(10)
+                  << (std::to_string(std::get<0>(c)) + "," + std::to_string(std::get<1>(c))) << std::right
+                  << arrow(std::get<2>(c)) << " '" << std::get<3>(c) << "'" << std::endl;
+    }
+
+    std::vector<std::pair<unsigned long long, Path>> hot_paths;
+    for (const std::pair<const Path, unsigned long long>& entry : paths) {
+        hot_paths.push_back(std::make_pair(entry.second * std::get<3>(entry.first).size(), entry.first));
+    }
+    std::sort(hot_paths.rbegin(), hot_paths.rend());
+    std::cout << std::endl << "hot paths, by instructions run" << std::endl;
+    for (size_t i = 0; i < hot_paths.size() && i < top; i++) {
+        const Path& p = hot_paths[i].second;
+        std::cout << std::setw(12) << hot_paths[i].first << "  " << std::left << std::setw(10)
+                  << (std::to_string(std::get<0>(p)) + "," + std::to_string(std::get<1>(p))) << std::right
+                  << arrow(std::get<2>(p)) << " " << std::get<3>(p) << "  x" << paths[p] << std::endl;
+    }
+
+    std::cout << std::endl << "last records" << std::endl;
+    size_t from = records.size() > last ? records.size() - last : 0;
+    for (size_t i = from; i < records.size(); i++) {
+        print_record(std::cout, first + i, records[i]);
+    }
+    return 0;
+}